@@ -0,0 +1,50 @@
+#include "atlas.hh"
+#include "pack.hh"
+#include <iostream>
+#include <string.h>
+
+Atlas::~Atlas() {
+  for (SDL_Surface *s: sprites) SDL_FreeSurface(s);
+  if (page) SDL_FreeSurface(page);
+}
+
+bool Atlas::load(SlicedBuffer *pack) {
+  BufferView rects = pack->lookup(AtlasTable::TABLE_NAME);
+  if (rects.sizeInBytes < sizeof(AtlasTable)) return false;
+  const AtlasTable *t = reinterpret_cast<const AtlasTable*>(rects.buffer);
+  if (t->magic != AtlasTable::MAGIC ||
+      t->numRects > (rects.sizeInBytes - sizeof(AtlasTable)) / sizeof(AtlasRect)) {
+    std::cerr << "Invalid atlas rect table" << std::endl;
+    return false;
+  }
+  page = pack->loadPNG(AtlasTable::PAGE_NAME);
+  if (!page) return false;
+  if (page->format->BitsPerPixel != 32) {
+    SDL_FreeSurface(page);
+    page = nullptr;
+    return false;
+  }
+  table = t;
+  return true;
+}
+
+SDL_Surface* Atlas::sprite(const char *fn) {
+  if (!table) return nullptr;
+  for (uint32_t i = 0; i < table->numRects; ++i) {
+    const AtlasRect &r = table->rects[i];
+    if (strncmp(r.name, fn, sizeof(r.name)) != 0) continue;
+    if (r.x + r.w > page->w || r.y + r.h > page->h) {
+      std::cerr << "Atlas rect of " << fn << " is outside the page" << std::endl;
+      return nullptr;
+    }
+    const SDL_PixelFormat *f = page->format;
+    uint8_t *pixels = static_cast<uint8_t*>(page->pixels) + r.y * page->pitch + r.x * 4;
+    SDL_Surface *s = SDL_CreateRGBSurfaceFrom(pixels, r.w, r.h, 32, page->pitch,
+        f->Rmask, f->Gmask, f->Bmask, f->Amask);
+    if (!s) return nullptr;
+    if (f->Amask) SDL_SetAlpha(s, SDL_SRCALPHA, SDL_ALPHA_OPAQUE);
+    sprites.push_back(s);
+    return s;
+  }
+  return nullptr;
+}
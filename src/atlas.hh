@@ -0,0 +1,44 @@
+#pragma once
+
+#include <SDL/SDL.h>
+#include <stdint.h>
+#include <vector>
+
+struct SlicedBuffer;
+
+/// Where a sprite is on the atlas page, name is the file name the
+/// sprite had in the pack (like "assets/vita.png")
+struct AtlasRect {
+  char name[32];
+  uint16_t x, y, w, h;
+};
+
+/// The rect table gentool stores in the pack next to the atlas page
+struct AtlasTable {
+  static const uint32_t MAGIC = 0x534C5441; // 'ATLS'
+  static constexpr const char *PAGE_NAME = "assets/atlas.pixels";
+  static constexpr const char *TABLE_NAME = "assets/atlas.rects";
+
+  uint32_t magic;
+  uint32_t numRects;
+  AtlasRect rects[0];
+};
+
+/// The sprites of a pack decoded together as one page. Every sprite is
+/// a surface of its own that shares the pixels of the page, so all the
+/// drawing code keeps working with plain surfaces.
+class Atlas {
+  SDL_Surface *page;
+  const AtlasTable *table;
+  std::vector<SDL_Surface*> sprites;
+public:
+  inline Atlas(): page(nullptr), table(nullptr) { }
+  ~Atlas();
+
+  /// Loads the page, returns false if the pack has no atlas
+  bool load(SlicedBuffer *pack);
+
+  /// Returns the sprite stored under fn, or nullptr if it isn't on the
+  /// page. The surface belongs to the atlas.
+  SDL_Surface* sprite(const char *fn);
+};
@@ -0,0 +1,226 @@
+#include "blit.hh"
+
+#if !defined(BLIT_SCALAR) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define BLIT_NEON
+#include <arm_neon.h>
+#elif !defined(BLIT_SCALAR) && defined(__SSE2__)
+#define BLIT_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const uint32_t ALPHA = 0xFF000000u;
+
+// alpha scaled to 0..256, so opaque pixels come out exact
+inline uint32_t scaleAlpha(uint32_t a) {
+  return a + (a >> 7);
+}
+
+// red and blue are blended side by side in one word, green in another,
+// neither can overflow into the next channel
+template<bool premultiplied> inline uint32_t blendPixel(uint32_t d, uint32_t s) {
+  uint32_t a = scaleAlpha(s >> 24);
+  uint32_t ia = 256 - a;
+  uint32_t rb, g;
+  if (premultiplied) {
+    rb = ((s & 0xFF00FF) << 8) + (d & 0xFF00FF) * ia;
+    g = ((s & 0xFF00) << 8) + (d & 0xFF00) * ia;
+  } else {
+    rb = (s & 0xFF00FF) * a + (d & 0xFF00FF) * ia;
+    g = (s & 0xFF00) * a + (d & 0xFF00) * ia;
+  }
+  return (rb >> 8 & 0xFF00FF) | (g >> 8 & 0xFF00) | (d & ALPHA);
+}
+
+template<bool premultiplied> void blendRowT(uint32_t *dst, const uint32_t *src, int count) {
+  int x = 0;
+#if defined(BLIT_NEON)
+  const uint32x4_t alphaMask = vdupq_n_u32(ALPHA);
+  const uint16x8_t full = vdupq_n_u16(256);
+  for (; x + 4 <= count; x += 4) {
+    uint32x4_t s = vld1q_u32(src + x);
+    uint32x4_t a = vshrq_n_u32(s, 24);
+    uint32x2_t any = vorr_u32(vget_low_u32(a), vget_high_u32(a));
+    if (!(vget_lane_u32(any, 0) | vget_lane_u32(any, 1))) continue;
+    uint32x4_t d = vld1q_u32(dst + x);
+    uint32x2_t all = vand_u32(vget_low_u32(a), vget_high_u32(a));
+    if ((vget_lane_u32(all, 0) & vget_lane_u32(all, 1)) == 0xFF) {
+      vst1q_u32(dst + x, vbslq_u32(alphaMask, d, s));
+      continue;
+    }
+    // alpha repeated in every byte of its pixel
+    uint8x16_t a8 = vreinterpretq_u8_u32(vmulq_n_u32(a, 0x01010101));
+    uint8x16_t s8 = vreinterpretq_u8_u32(s);
+    uint8x16_t d8 = vreinterpretq_u8_u32(d);
+    uint16x8_t aLo = vmovl_u8(vget_low_u8(a8));
+    uint16x8_t aHi = vmovl_u8(vget_high_u8(a8));
+    aLo = vsraq_n_u16(aLo, aLo, 7);
+    aHi = vsraq_n_u16(aHi, aHi, 7);
+    uint16x8_t lo = vmulq_u16(vmovl_u8(vget_low_u8(d8)), vsubq_u16(full, aLo));
+    uint16x8_t hi = vmulq_u16(vmovl_u8(vget_high_u8(d8)), vsubq_u16(full, aHi));
+    uint8x16_t r;
+    if (premultiplied) {
+      r = vqaddq_u8(vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)), s8);
+    } else {
+      lo = vmlaq_u16(lo, vmovl_u8(vget_low_u8(s8)), aLo);
+      hi = vmlaq_u16(hi, vmovl_u8(vget_high_u8(s8)), aHi);
+      r = vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8));
+    }
+    vst1q_u32(dst + x, vbslq_u32(alphaMask, d, vreinterpretq_u32_u8(r)));
+  }
+#elif defined(BLIT_SSE2)
+  const __m128i alphaMask = _mm_set1_epi32(ALPHA);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i opaque = _mm_set1_epi32(0xFF);
+  const __m128i full = _mm_set1_epi16(256);
+  for (; x + 4 <= count; x += 4) {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+    __m128i a = _mm_srli_epi32(s, 24);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, zero)) == 0xFFFF) continue;
+    __m128i *dp = reinterpret_cast<__m128i*>(dst + x);
+    __m128i d = _mm_loadu_si128(dp);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, opaque)) == 0xFFFF) {
+      _mm_storeu_si128(dp, _mm_or_si128(_mm_and_si128(d, alphaMask), _mm_andnot_si128(alphaMask, s)));
+      continue;
+    }
+    __m128i sLo = _mm_unpacklo_epi8(s, zero);
+    __m128i sHi = _mm_unpackhi_epi8(s, zero);
+    // each pixel is B, G, R, A in four words, repeat A over them
+    __m128i aLo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sLo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i aHi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sHi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    aLo = _mm_add_epi16(aLo, _mm_srli_epi16(aLo, 7));
+    aHi = _mm_add_epi16(aHi, _mm_srli_epi16(aHi, 7));
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(full, aLo));
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, aHi));
+    __m128i r;
+    if (premultiplied) {
+      r = _mm_adds_epu8(_mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)), s);
+    } else {
+      lo = _mm_add_epi16(lo, _mm_mullo_epi16(sLo, aLo));
+      hi = _mm_add_epi16(hi, _mm_mullo_epi16(sHi, aHi));
+      r = _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+    }
+    _mm_storeu_si128(dp, _mm_or_si128(_mm_and_si128(d, alphaMask), _mm_andnot_si128(alphaMask, r)));
+  }
+#endif
+  for (; x < count; ++x) {
+    uint32_t s = src[x];
+    uint32_t a = s >> 24;
+    if (!a) continue;
+    dst[x] = a == 0xFF ? (s & ~ALPHA) | (dst[x] & ALPHA) : blendPixel<premultiplied>(dst[x], s);
+  }
+}
+
+}
+
+void blendRow(uint32_t *dst, const uint32_t *src, int count, AlphaMode mode) {
+  if (mode == AlphaMode::premultiplied) {
+    blendRowT<true>(dst, src, count);
+  } else {
+    blendRowT<false>(dst, src, count);
+  }
+}
+
+bool clipBlit(int srcWidth, int srcHeight, const SDL_Rect *srcRect, const SDL_Surface *dst,
+    SDL_Rect *dstRect, SDL_Rect &area) {
+  // the same clipping as SDL_UpperBlit
+  int sx = 0, sy = 0;
+  int w = srcWidth, h = srcHeight;
+  int dx = dstRect->x, dy = dstRect->y;
+  if (srcRect) {
+    sx = srcRect->x;
+    sy = srcRect->y;
+    w = srcRect->w;
+    h = srcRect->h;
+    if (sx < 0) {
+      w += sx;
+      dx -= sx;
+      sx = 0;
+    }
+    if (sy < 0) {
+      h += sy;
+      dy -= sy;
+      sy = 0;
+    }
+    if (w > srcWidth - sx) w = srcWidth - sx;
+    if (h > srcHeight - sy) h = srcHeight - sy;
+  }
+  const SDL_Rect &clip = dst->clip_rect;
+  if (dx < clip.x) {
+    w -= clip.x - dx;
+    sx += clip.x - dx;
+    dx = clip.x;
+  }
+  if (dy < clip.y) {
+    h -= clip.y - dy;
+    sy += clip.y - dy;
+    dy = clip.y;
+  }
+  if (w > clip.x + clip.w - dx) w = clip.x + clip.w - dx;
+  if (h > clip.y + clip.h - dy) h = clip.y + clip.h - dy;
+  dstRect->x = dx;
+  dstRect->y = dy;
+  if (w <= 0 || h <= 0) {
+    dstRect->w = dstRect->h = 0;
+    return false;
+  }
+  dstRect->w = w;
+  dstRect->h = h;
+  area.x = sx;
+  area.y = sy;
+  area.w = w;
+  area.h = h;
+  return true;
+}
+
+bool canBlend(const SDL_Surface *src, const SDL_Surface *dst) {
+  const SDL_PixelFormat *sf = src->format;
+  const SDL_PixelFormat *df = dst->format;
+  return (src->flags & SDL_SRCALPHA) && sf->BitsPerPixel == 32 && df->BitsPerPixel == 32 &&
+      sf->Amask == ALPHA && (!df->Amask || df->Amask == ALPHA) &&
+      sf->Rmask == df->Rmask && sf->Gmask == df->Gmask && sf->Bmask == df->Bmask;
+}
+
+int blendBlit(SDL_Surface *src, SDL_Rect *srcRect, SDL_Surface *dst, SDL_Rect *dstRect, AlphaMode mode) {
+  if (!canBlend(src, dst)) return SDL_BlitSurface(src, srcRect, dst, dstRect);
+
+  SDL_Rect fullDst { 0, 0, 0, 0 };
+  if (!dstRect) dstRect = &fullDst;
+  SDL_Rect area;
+  if (!clipBlit(src->w, src->h, srcRect, dst, dstRect, area)) return 0;
+
+  if (SDL_MUSTLOCK(dst) && SDL_LockSurface(dst) < 0) return -1;
+  if (SDL_MUSTLOCK(src) && SDL_LockSurface(src) < 0) {
+    if (SDL_MUSTLOCK(dst)) SDL_UnlockSurface(dst);
+    return -1;
+  }
+  int32_t srcPitch = src->pitch >> 2;
+  int32_t dstPitch = dst->pitch >> 2;
+  const uint32_t *sp = static_cast<const uint32_t*>(src->pixels) + area.y * srcPitch + area.x;
+  uint32_t *dp = static_cast<uint32_t*>(dst->pixels) + dstRect->y * dstPitch + dstRect->x;
+  for (int y = 0; y < area.h; ++y) {
+    blendRow(dp, sp, area.w, mode);
+    sp += srcPitch;
+    dp += dstPitch;
+  }
+  if (SDL_MUSTLOCK(src)) SDL_UnlockSurface(src);
+  if (SDL_MUSTLOCK(dst)) SDL_UnlockSurface(dst);
+  return 0;
+}
+
+void premultiplyAlpha(SDL_Surface *surface) {
+  if (surface->format->BitsPerPixel != 32 || surface->format->Amask != ALPHA) return;
+  SDL_LockSurface(surface);
+  int32_t pitch = surface->pitch >> 2;
+  uint32_t *line = static_cast<uint32_t*>(surface->pixels);
+  for (int y = 0; y < surface->h; ++y) {
+    for (int x = 0; x < surface->w; ++x) {
+      uint32_t p = line[x];
+      uint32_t a = scaleAlpha(p >> 24);
+      line[x] = ((p & 0xFF00FF) * a >> 8 & 0xFF00FF) | ((p & 0xFF00) * a >> 8 & 0xFF00) | (p & ALPHA);
+    }
+    line += pitch;
+  }
+  SDL_UnlockSurface(surface);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <SDL/SDL.h>
+#include <stdint.h>
+
+enum class AlphaMode {
+  // the usual SDL kind, colors are scaled by alpha when blending
+  straight,
+  // colors are already scaled by alpha, see premultiplyAlpha
+  premultiplied,
+};
+
+/// Alpha blends count ARGB pixels of src onto dst, keeping the alpha
+/// channel of dst. Fully transparent and fully opaque runs of pixels
+/// are skipped or copied without blending.
+///
+/// Uses NEON or SSE2 where available, define BLIT_SCALAR to
+/// force the portable version.
+void blendRow(uint32_t *dst, const uint32_t *src, int count, AlphaMode mode);
+
+/// Clips a blit of srcRect (null for the whole srcWidth x srcHeight
+/// source) the way SDL_BlitSurface does: dstRect is clipped to the clip
+/// rect of dst and updated with the area to draw, area gets the matching
+/// part of the source. Returns false if nothing is left to draw.
+bool clipBlit(int srcWidth, int srcHeight, const SDL_Rect *srcRect, const SDL_Surface *dst,
+    SDL_Rect *dstRect, SDL_Rect &area);
+
+/// Whether blendBlit blends src onto dst itself
+/// rather than passing it on to SDL_BlitSurface
+bool canBlend(const SDL_Surface *src, const SDL_Surface *dst);
+
+/// Drop in replacement for SDL_BlitSurface for sprites with per pixel
+/// alpha. The rects behave the same way: srcRect can be null for the
+/// whole surface, dstRect is clipped to the clip rect of dst and
+/// updated with the area that was actually drawn (w and h are ignored
+/// on input).
+///
+/// Anything it can't blend itself (no SDL_SRCALPHA, not 32 bit or
+/// color channels not matching dst) is passed on to SDL_BlitSurface,
+/// premultiplied surfaces have to match.
+int blendBlit(SDL_Surface *src, SDL_Rect *srcRect, SDL_Surface *dst, SDL_Rect *dstRect,
+    AlphaMode mode = AlphaMode::straight);
+
+/// Scales the color channels of a 32 bit surface with per pixel
+/// alpha by alpha in place, for blitting with AlphaMode::premultiplied
+void premultiplyAlpha(SDL_Surface *surface);
@@ -1,9 +1,16 @@
 #include <SDL/SDL.h>
 #include <iostream>
 #include <fstream>
+#include <vector>
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+// decode the music ahead on a background thread
+#define MUSIC_THREAD
 #endif
 
 #include "util.hh"
@@ -13,6 +20,17 @@
 #include "pack.hh"
 #include "fda.h"
 #include "menu.hh"
+#include "mix.hh"
+#include "spsc.hh"
+#include "jobs.hh"
+#include "present.hh"
+#include "dirty.hh"
+#include "format.hh"
+#include "profiler.hh"
+#include "trace.hh"
+#include "blit.hh"
+#include "rle.hh"
+#include "atlas.hh"
 
 #ifdef __EMSCRIPTEN__
 // no blowup
@@ -37,6 +55,11 @@
 #define BLOWUP 1
 #endif
 
+#if BLOWUP && !defined(__EMSCRIPTEN__)
+// the upscale and flip of a frame can overlap drawing the next one
+#define PRESENT_THREAD
+#endif
+
 #if defined(DESKTOP)
 static const char * const LAYOUT_FILE = "PC";
 #elif defined(MIYOO) || defined(MIYOOA30)
@@ -137,6 +160,15 @@ struct MixChannel {
   }
 };
 
+/// A source of samples the mixer pulls from directly in the
+/// audio callback, instead of having buffers queued as sounds
+class MixStream {
+public:
+  /// Called on the audio thread, mixes up to numSamples samples into dst
+  /// and returns the number of samples that were available
+  virtual uint32_t mixInto(uint32_t *dst, uint32_t numSamples) = 0;
+};
+
 class Mixer {
   static const int maxNumChannels = 16;
   static const int soundQueueSize = 16;
@@ -145,25 +177,30 @@ class Mixer {
   uint32_t playIdCounter;
   uint64_t audioTime[4];
   Timestamp times[4];
-  MixChannel soundsToAdd[soundQueueSize];
-  int soundRead;
-  int soundWrite;
+  // game thread -> audio thread
+  SpscQueue<MixChannel, soundQueueSize> soundsToAdd;
   MixChannel channels[maxNumChannels];
   int numChannelsUsed;
-  int currentTimes;
-  uint32_t donePlaying[donePlayingQueueSize];
-  int donePlayingRead;
-  int donePlayingWrite;
+  // published by the audio thread after audioTime and times are written
+  std::atomic<int> currentTimes;
+  // audio thread -> game thread
+  SpscQueue<uint32_t, donePlayingQueueSize> donePlaying;
+  std::atomic<MixStream*> mixStream;
+  // set by the audio thread while it may be inside mixStream->mixInto
+  std::atomic<bool> mixingStream;
 public:
-  inline Mixer(): audioTime { 0, 0, 0, 0 }, currentTimes(0), soundRead(0), soundWrite(0), donePlayingRead(0), donePlayingWrite(0) { }
+  inline Mixer(): playIdCounter(0), audioTime { 0, 0, 0, 0 }, numChannelsUsed(0), currentTimes(0), mixStream(nullptr), mixingStream(false) { }
   void audioCallback(uint8_t *stream, int len);
   uint32_t playSound(const SoundBufferView *buffer);
   uint32_t playSoundAt(const SoundBufferView *buffer, uint32_t at);
+  /// Sets the stream mixed on top of the sounds (nullptr to stop it),
+  /// the audio thread is done with the previous one when it returns
+  void setStream(MixStream *newStream);
   inline uint64_t getAudioTime() {
-    return audioTime[currentTimes];
+    return audioTime[currentTimes.load(std::memory_order_acquire)];
   }
   inline uint64_t getAudioTimeNow() {
-    int w = currentTimes;
+    int w = currentTimes.load(std::memory_order_acquire);
     return audioTime[w] + times[w].elapsedSeconds() * 44100;
   }
   /// Returns the next playId that has just finished, or 0
@@ -172,23 +209,24 @@ public:
 };
 
 void Mixer::audioCallback(uint8_t *stream, int len) {
-  uint64_t time = audioTime[currentTimes];
+  int current = currentTimes.load(std::memory_order_relaxed);
+  uint64_t time = audioTime[current];
   int numSamples = len / 4;
 
   if (time < len) {
     std::cerr << "audioCallback at " << time << std::endl;
   }
 
-  int nextWatch = (currentTimes + 1) & 3;
+  int nextWatch = (current + 1) & 3;
   times[nextWatch].reset();
   audioTime[nextWatch] = time + numSamples;
-  currentTimes = nextWatch;
+  currentTimes.store(nextWatch, std::memory_order_release);
 
   // remove finished channels
   for (int i = numChannelsUsed - 1; i >= 0; --i) {
     if (channels[i].isOver(time)) {
-      donePlaying[donePlayingWrite] = channels[i].playId;
-      donePlayingWrite = (donePlayingWrite+1) & (donePlayingQueueSize - 1);
+      // overflows are counted by the queue and reported on the game thread
+      donePlaying.push(channels[i].playId);
       if (i < numChannelsUsed - 1) {
         // swap with last
         channels[i] = channels[numChannelsUsed - 1];
@@ -196,33 +234,39 @@ void Mixer::audioCallback(uint8_t *stream, int len) {
       --numChannelsUsed;
     }
   }
-  // add new channels
-  while (soundRead != soundWrite) {
-    channels[numChannelsUsed++] = soundsToAdd[soundRead];
-    soundRead = (soundRead + 1) & (soundQueueSize - 1);
+  // add new channels, the rest stays queued until a channel frees up
+  while (numChannelsUsed < maxNumChannels && soundsToAdd.pop(channels[numChannelsUsed])) {
+    ++numChannelsUsed;
   }
 
+  // every channel covers a single contiguous span of the callback window,
+  // so mix whole spans instead of visiting each channel for every sample
   uint32_t *s = reinterpret_cast<uint32_t*>(stream);
-  for (int i = 0; i < numSamples; ++i) {
-    int mix[2] { 0, 0 };
-    for (int j = 0; j < numChannelsUsed; ++j) {
-      MixChannel &ch(channels[j]);
-      uint64_t start = ch.timeStart;
-      if (start <= time && !ch.isOver(time)) {
-        uint32_t sampleIndex = time - start;
-        uint32_t sample = ch.buffer->samples[sampleIndex];
-        for (int k = 0; k < 2; ++k) {
-          mix[k] += static_cast<int16_t>(sample >> (k * 16));
-        }
-      }
-    }
-    for (int k = 0; k < 2; ++k) {
-      if (mix[k] > 32767) mix[k] = 32767;
-      if (mix[k] < -32768) mix[k] = -32768;
-    }
-    *s++ = (mix[1] << 16) | (mix[0] & 0xffff);
-    ++time;
+  memset(s, 0, numSamples * 4);
+  uint64_t windowEnd = time + numSamples;
+  for (int j = 0; j < numChannelsUsed; ++j) {
+    MixChannel &ch(channels[j]);
+    if (!ch.buffer) continue;
+    uint64_t start = ch.timeStart;
+    uint64_t end = start + ch.buffer->numSamples;
+    uint64_t spanStart = start > time ? start : time;
+    uint64_t spanEnd = end < windowEnd ? end : windowEnd;
+    if (spanStart >= spanEnd) continue;
+    mixSaturate(s + (spanStart - time), ch.buffer->samples + (spanStart - start), spanEnd - spanStart);
   }
+
+  // sequentially consistent with setStream: either the swap is seen here
+  // or setStream sees the flag and waits for the mixing to finish
+  mixingStream.store(true);
+  MixStream *currentStream = mixStream.load();
+  if (currentStream) currentStream->mixInto(s, numSamples);
+  mixingStream.store(false, std::memory_order_release);
+}
+
+void Mixer::setStream(MixStream *newStream) {
+  mixStream.store(newStream);
+  // not SDL_LockAudio, the miyoo audio thread doesn't take that lock
+  while (mixingStream.load()) SDL_Delay(1);
 }
 
 uint32_t Mixer::playSound(const SoundBufferView *buffer) {
@@ -230,50 +274,133 @@ uint32_t Mixer::playSound(const SoundBufferView *buffer) {
 }
 
 uint32_t Mixer::playSoundAt(const SoundBufferView *buffer, uint32_t at) {
-  MixChannel &ch(soundsToAdd[soundWrite]);
+  MixChannel ch;
   ch.buffer = buffer;
   ch.playId = ++playIdCounter;
   if (ch.playId == 0) ch.playId = ++playIdCounter;
   ch.timeStart = at;
-  soundWrite = (soundWrite + 1) & (soundQueueSize - 1);
+  if (!soundsToAdd.push(ch)) {
+    std::cerr << "Sound queue is full, dropping sound " << ch.playId << std::endl;
+    return 0;
+  }
   return ch.playId;
 }
 
 uint32_t Mixer::nextDonePlaying() {
-  if (donePlayingRead == donePlayingWrite) return 0;
-  uint32_t result = donePlaying[donePlayingRead];
-  donePlayingRead = (donePlayingRead+1) & (donePlayingQueueSize - 1);
+  uint32_t lost = donePlaying.takeOverflows();
+  if (lost) {
+    std::cerr << "Done playing queue overflowed, lost " << lost << " notifications" << std::endl;
+  }
+  uint32_t result;
+  if (!donePlaying.pop(result)) return 0;
   return result;
 }
 
-class FdaStreamer {
+class FdaStreamer: public MixStream {
+#ifdef MUSIC_THREAD
+  // one FDA frame per block, that's ~116 ms each
+  static const int numBlocks = 4;
+  static const uint32_t blockSamples = FDA_FRAME_LEN;
+#else
+  static const int numBlocks = 2;
+  static const uint32_t blockSamples = 5120*4;
+#endif
+
   Mixer &mixer;
   BufferView compressed;
-  SoundBuffer buffers[2];
-  SoundBufferView views[2];
+  SoundBuffer buffers[numBlocks];
+  SoundBufferView views[numBlocks];
   uint32_t compressedPosition;
-  uint32_t pendingPlayIds[2];
-  uint64_t timeNext;
   uint32_t samplesPerFrame;
   fda_desc fda;
+  // byte offset of every frame, frame i starts at sample i * FDA_FRAME_LEN
+  uint32_t *frameOffsets;
+  uint32_t numFrames;
+  // samples to drop from the start of the next filled block after a seek
+  uint32_t skipSamples;
+  // where the next startPlaying or the pending seek starts from
+  std::atomic<uint32_t> seekTarget;
+#ifdef MUSIC_THREAD
+  // decoder thread -> audio thread
+  SpscQueue<int, numBlocks> filledBlocks;
+  // audio thread -> decoder thread
+  SpscQueue<int, numBlocks> freeBlocks;
+  // only used on the audio thread
+  int currentBlock;
+  uint32_t blockPosition;
+  std::atomic<uint32_t> underruns;
+  std::atomic<bool> decoding;
+  std::thread decoder;
+  // seek requests from the game thread, blocks decoded before the
+  // latest request are dropped by the audio thread
+  std::atomic<uint32_t> seekGeneration;
+  uint32_t blockGenerations[numBlocks];
+
+  void decodeLoop();
+#else
+  uint32_t pendingPlayIds[numBlocks];
+  uint64_t timeNext;
+#endif
 
   void fillBuffer(int index);
+  void moveTo(uint32_t sampleIndex);
 public:
   inline FdaStreamer(Mixer &mixer):
       mixer(mixer),
       compressed { .buffer = nullptr, .sizeInBytes = 0 },
-      timeNext(0),
-      samplesPerFrame(0) {
-    buffers[0].resize(5120*4);
-    buffers[1].resize(5120*4);
+      samplesPerFrame(0),
+      frameOffsets(nullptr),
+      numFrames(0),
+      skipSamples(0),
+      seekTarget(0) {
+    for (int i = 0; i < numBlocks; ++i) {
+      buffers[i].resize(blockSamples);
+    }
+#ifdef MUSIC_THREAD
+    currentBlock = -1;
+    blockPosition = 0;
+    underruns = 0;
+    decoding = false;
+    seekGeneration = 0;
+    for (int i = 0; i < numBlocks; ++i) blockGenerations[i] = 0;
+#else
+    timeNext = 0;
+#endif
   }
+  ~FdaStreamer();
 
+  /// Sets the compressed data, the stream must not be playing
   void reset(const BufferView &comp);
   void startPlaying();
+  void stop();
+  /// Continues playback from the given sample, wrapping around at the end.
+  /// With the music thread the blocks decoded ahead are dropped, otherwise
+  /// the blocks already queued in the mixer play out first.
+  void seek(uint32_t sampleIndex);
   void handleDone(uint32_t playId);
+  virtual uint32_t mixInto(uint32_t *dst, uint32_t numSamples) override;
 };
 
+FdaStreamer::~FdaStreamer() {
+  stop();
+  delete[] frameOffsets;
+}
+
+void FdaStreamer::moveTo(uint32_t sampleIndex) {
+  if (!numFrames) {
+    compressedPosition = fda_decode_header(compressed.atOffset(0), compressed.sizeInBytes, &fda);
+    skipSamples = 0;
+    return;
+  }
+  if (fda.samples) sampleIndex %= fda.samples;
+  uint32_t frame = sampleIndex / FDA_FRAME_LEN;
+  if (frame >= numFrames) frame = 0;
+  compressedPosition = frameOffsets[frame];
+  skipSamples = sampleIndex - frame * FDA_FRAME_LEN;
+}
+
 void FdaStreamer::fillBuffer(int index) {
+  trace::Scope scope("fillBuffer");
   SoundBuffer &buf(buffers[index]);
   views[index] = buf;
   int16_t *start = reinterpret_cast<int16_t*>(buf.samples);
@@ -281,12 +408,12 @@ void FdaStreamer::fillBuffer(int index) {
   int samplesLeft = buf.numSamples;
   while (start < end && samplesLeft >= samplesPerFrame) {
     if (compressedPosition >= compressed.sizeInBytes) {
-      compressedPosition = fda_decode_header(compressed.atOffset(0), compressed.sizeInBytes, &fda);
+      moveTo(0);
     }
     unsigned numSamples = samplesLeft;
     uint8_t *p = compressed.atOffset(compressedPosition);
     uint32_t bytesLeft = compressed.sizeInBytes - compressedPosition;
-    unsigned frameSize = fda_decode_frame(p, bytesLeft, &fda, start, &numSamples);
+    unsigned frameSize = fda_decode_frame_fast(p, bytesLeft, &fda, start, &numSamples);
     if (!samplesPerFrame) samplesPerFrame = numSamples;
     if (!frameSize) {
       compressedPosition = compressed.sizeInBytes;
@@ -297,18 +424,147 @@ void FdaStreamer::fillBuffer(int index) {
     samplesLeft -= numSamples;
   }
   if (samplesLeft) {
+#ifndef MUSIC_THREAD
+    // with a block per frame a short last frame is expected, so only log here
     std::cout << "Samples left: " << samplesLeft << std::endl;
+#endif
     views[index].numSamples = buf.numSamples - samplesLeft;
   }
+  if (skipSamples) {
+    uint32_t skip = skipSamples < views[index].numSamples ? skipSamples : views[index].numSamples;
+    views[index].samples += skip;
+    views[index].numSamples -= skip;
+    skipSamples = 0;
+  }
 }
 
 void FdaStreamer::reset(const BufferView &comp) {
+#ifndef MUSIC_THREAD
   pendingPlayIds[0] = pendingPlayIds[1] = 0;
+#endif
   compressed = comp;
+  delete[] frameOffsets;
+  frameOffsets = nullptr;
+  numFrames = 0;
+  skipSamples = 0;
+  if (fda_decode_header(compressed.atOffset(0), compressed.sizeInBytes, &fda)) {
+    uint32_t maxFrames = (fda.samples + FDA_FRAME_LEN - 1) / FDA_FRAME_LEN;
+    frameOffsets = new uint32_t[maxFrames];
+    numFrames = fda_index_frames(compressed.atOffset(0), compressed.sizeInBytes, frameOffsets, maxFrames);
+  }
 }
 
+#ifdef MUSIC_THREAD
+
 void FdaStreamer::startPlaying() {
-  compressedPosition = fda_decode_header(compressed.atOffset(0), compressed.sizeInBytes, &fda);
+  if (decoding) return;
+  moveTo(seekTarget);
+  int block;
+  while (filledBlocks.pop(block));
+  while (freeBlocks.pop(block));
+  currentBlock = -1;
+  blockPosition = 0;
+  // have everything decoded before the mixer starts pulling
+  uint32_t generation = seekGeneration;
+  for (int i = 0; i < numBlocks; ++i) {
+    fillBuffer(i);
+    blockGenerations[i] = generation;
+    filledBlocks.push(i);
+  }
+  decoding = true;
+  decoder = std::thread(&FdaStreamer::decodeLoop, this);
+  mixer.setStream(this);
+}
+
+void FdaStreamer::stop() {
+  if (!decoding) return;
+  // no callback touches the queues after this, startPlaying can reset them
+  mixer.setStream(nullptr);
+  decoding = false;
+  decoder.join();
+}
+
+void FdaStreamer::seek(uint32_t sampleIndex) {
+  if (!decoding) {
+    // picked up by startPlaying
+    seekTarget = sampleIndex;
+    return;
+  }
+  seekTarget.store(sampleIndex, std::memory_order_relaxed);
+  seekGeneration.fetch_add(1, std::memory_order_release);
+}
+
+void FdaStreamer::decodeLoop() {
+  trace::setThreadName("decoder");
+  uint32_t generation = seekGeneration.load(std::memory_order_acquire);
+  bool seeking = false;
+  while (decoding) {
+    uint32_t requested = seekGeneration.load(std::memory_order_acquire);
+    if (requested != generation) {
+      generation = requested;
+      moveTo(seekTarget.load(std::memory_order_relaxed));
+      seeking = true;
+    }
+    int block;
+    if (freeBlocks.pop(block)) {
+      fillBuffer(block);
+      blockGenerations[block] = generation;
+      filledBlocks.push(block);
+      seeking = false;
+    } else {
+      uint32_t lost = underruns.exchange(0);
+      if (lost && !seeking) std::cerr << "Music underrun in " << lost << " callbacks" << std::endl;
+      // a block lasts for ~116 ms, check back a few times per block,
+      // but refill quickly while the mixer is waiting after a seek
+      SDL_Delay(seeking ? 2 : 20);
+    }
+  }
+}
+
+void FdaStreamer::handleDone(uint32_t /*playId*/) {
+  // the mixer pulls the blocks directly, nothing is queued as a sound
+}
+
+uint32_t FdaStreamer::mixInto(uint32_t *dst, uint32_t numSamples) {
+  uint32_t generation = seekGeneration.load(std::memory_order_acquire);
+  if (currentBlock >= 0 && blockGenerations[currentBlock] != generation) {
+    freeBlocks.push(currentBlock);
+    currentBlock = -1;
+  }
+  uint32_t mixed = 0;
+  while (mixed < numSamples) {
+    if (currentBlock < 0) {
+      if (!filledBlocks.pop(currentBlock)) {
+        currentBlock = -1;
+        underruns.fetch_add(1, std::memory_order_relaxed);
+        break;
+      }
+      blockPosition = 0;
+      if (blockGenerations[currentBlock] != generation) {
+        // decoded before a seek
+        freeBlocks.push(currentBlock);
+        currentBlock = -1;
+        continue;
+      }
+    }
+    const SoundBufferView &view(views[currentBlock]);
+    uint32_t count = view.numSamples - blockPosition;
+    if (count > numSamples - mixed) count = numSamples - mixed;
+    mixSaturate(dst + mixed, view.samples + blockPosition, count);
+    mixed += count;
+    blockPosition += count;
+    if (blockPosition >= view.numSamples) {
+      freeBlocks.push(currentBlock);
+      currentBlock = -1;
+    }
+  }
+  return mixed;
+}
+
+#else
+
+void FdaStreamer::startPlaying() {
+  moveTo(seekTarget);
   fillBuffer(0);
   fillBuffer(1);
   timeNext = mixer.getAudioTimeNow();
@@ -318,6 +574,15 @@ void FdaStreamer::startPlaying() {
   }
 }
 
+void FdaStreamer::stop() {
+  pendingPlayIds[0] = pendingPlayIds[1] = 0;
+}
+
+void FdaStreamer::seek(uint32_t sampleIndex) {
+  seekTarget = sampleIndex;
+  moveTo(sampleIndex);
+}
+
 void FdaStreamer::handleDone(uint32_t playId) {
   for (int i = 0; i < 2; ++i) {
     if (playId == pendingPlayIds[i]) {
@@ -328,6 +593,13 @@ void FdaStreamer::handleDone(uint32_t playId) {
   }
 }
 
+uint32_t FdaStreamer::mixInto(uint32_t* /*dst*/, uint32_t /*numSamples*/) {
+  // the blocks are queued as regular sounds in this mode
+  return 0;
+}
+
+#endif
+
 struct PixelPtr {
   uint32_t *pixel;
   int32_t pixelPitch;
@@ -399,6 +671,8 @@ struct Appearance {
 
   uint32_t color;
   SDL_Surface *surface;
+  // drawn from these runs instead of surface when they aren't empty
+  const RleSprite *rle;
   int frameWidth;
   int frameHeight;
   int frameX;
@@ -409,7 +683,7 @@ struct Appearance {
   int coverHeight;
   int flags;
 
-  Appearance(): surface(nullptr), frameWidth(0), frameHeight(0), xOffset(0), yOffset(0), flags(SHADOW) { }
+  Appearance(): surface(nullptr), rle(nullptr), frameWidth(0), frameHeight(0), xOffset(0), yOffset(0), flags(SHADOW) { }
 };
 
 struct Dino {
@@ -470,6 +744,106 @@ void Obstacle::reset(int width, int height) {
   id = ++idCounter;
 }
 
+/// Building obstacles composed from their 12x12 tiles once, so drawing
+/// one is a single blit instead of one per tile. There is one surface
+/// per cover size, shared by every obstacle of that size.
+class CoverCache {
+  static const int MAX_COVERS = 32;
+
+  struct Entry {
+    int coverWidth;
+    int coverHeight;
+    uint32_t lastUsed;
+    SDL_Surface *surface;
+    RleSprite rle;
+  };
+  std::vector<Entry> entries;
+  uint32_t useCounter;
+
+  static SDL_Surface* compose(SDL_Surface *tiles, int tileWidth, int tileHeight, int coverWidth, int coverHeight);
+public:
+  inline CoverCache(): useCounter(0) {
+    // the appearances point into the entries
+    entries.reserve(MAX_COVERS);
+  }
+  ~CoverCache();
+
+  /// Returns the composed surface for the cover size, or nullptr if it
+  /// couldn't be created, and its runs in rle. When the cache is full,
+  /// the least recently used surface not shown by any of the live
+  /// obstacles is replaced.
+  SDL_Surface* get(SDL_Surface *tiles, int tileWidth, int tileHeight, int coverWidth, int coverHeight,
+      const Obstacle *live, int numLive, const RleSprite *&rle);
+};
+
+CoverCache::~CoverCache() {
+  for (Entry &e : entries) SDL_FreeSurface(e.surface);
+}
+
+SDL_Surface* CoverCache::compose(SDL_Surface *tiles, int tileWidth, int tileHeight, int coverWidth, int coverHeight) {
+  SDL_Surface *result = SDL_CreateRGBSurface(0, tileWidth * coverWidth, tileHeight * coverHeight, 32,
+      tiles->format->Rmask, tiles->format->Gmask, tiles->format->Bmask,
+      tiles->format->Amask);
+  if (!result) return nullptr;
+  SDL_LockSurface(tiles);
+  SDL_LockSurface(result);
+  PixelPtr dp(result);
+  for (int y = 0; y < coverHeight; ++y) {
+    // the first row uses the top tiles, the rest the middle ones
+    int fy = y ? 1 : 0;
+    for (int ty = 0; ty < tileHeight; ++ty) {
+      uint32_t *dst = dp;
+      const uint32_t *src = static_cast<const uint32_t*>(tiles->pixels) + (fy * tileHeight + ty) * (tiles->pitch >> 2);
+      for (int x = 0; x < coverWidth; ++x) {
+        // left edge, middle and right edge tiles
+        int fx = !x ? 0 : x == coverWidth - 1 ? 2 : 1;
+        memcpy(dst, src + fx * tileWidth, tileWidth * 4);
+        dst += tileWidth;
+      }
+      dp.nextLine();
+    }
+  }
+  SDL_UnlockSurface(result);
+  SDL_UnlockSurface(tiles);
+  SDL_SetAlpha(result, tiles->flags & SDL_SRCALPHA, tiles->format->alpha);
+  return result;
+}
+
+SDL_Surface* CoverCache::get(SDL_Surface *tiles, int tileWidth, int tileHeight, int coverWidth, int coverHeight,
+    const Obstacle *live, int numLive, const RleSprite *&rle) {
+  ++useCounter;
+  for (Entry &e : entries) {
+    if (e.surface && e.coverWidth == coverWidth && e.coverHeight == coverHeight) {
+      e.lastUsed = useCounter;
+      rle = &e.rle;
+      return e.surface;
+    }
+  }
+  Entry *slot = nullptr;
+  if (entries.size() < MAX_COVERS) {
+    entries.push_back(Entry {});
+    slot = &entries.back();
+  } else {
+    for (Entry &e : entries) {
+      bool shown = false;
+      for (int i = 0; i < numLive && !shown; ++i) shown = live[i].appearance.surface == e.surface;
+      if (!shown && (!slot || e.lastUsed < slot->lastUsed)) slot = &e;
+    }
+    if (!slot) return nullptr;
+    SDL_FreeSurface(slot->surface);
+  }
+  slot->coverWidth = coverWidth;
+  slot->coverHeight = coverHeight;
+  slot->lastUsed = useCounter;
+  slot->surface = compose(tiles, tileWidth, tileHeight, coverWidth, coverHeight);
+  // a failed slot stays empty, moving another one there would leave
+  // appearances pointing at the wrong runs
+  if (!slot->surface) return nullptr;
+  slot->rle.encode(slot->surface);
+  rle = &slot->rle;
+  return slot->surface;
+}
+
 enum class Activity { playing, stopping, menu };
 
 void callAudioCallback(void *userdata, uint8_t *stream, int len);
@@ -499,15 +873,51 @@ class DinoJump: private GameSettings {
   SDL_Surface *wideShadow;
   SDL_Surface *blimp;
   SDL_Surface *building;
+  // the sprites as runs, empty when they can't be blitted that way
+  RleSprite vitaRle;
+  RleSprite groundRle;
+  RleSprite shadowRle;
+  RleSprite wideShadowRle;
+  RleSprite blimpRle;
 
   PerfTextOverlay overlay;
+  Profiler profiler;
+  // only what was drawn over gets restored from bg
+  DirtyRects dirty;
 
   bool audioInitialized;
+  // the trace buffer of the SDL audio thread, allocated before it starts
+  int audioTraceId;
   SoundBuffer jump;
   SoundBuffer step;
   SoundBuffer collide;
   Mixer mixer;
-  BufferView compressedMusic;
+  // the whole asset pack, the music streams straight out of it
+  PackFile assetPack;
+  // the sprites when the pack has them on an atlas page
+  Atlas atlas;
+  JobPool jobs;
+  // the BLOWUP present is split into this many bands run on jobs
+  int presentBands;
+#ifdef PRESENT_THREAD
+  // with the present thread running, frames are drawn into one screen
+  // while the other one is presented, a frame of extra latency
+  SDL_Surface *screens[2];
+  int drawIndex;
+  bool screenBusy[2];
+  int framePending;
+  bool presenting;
+  std::mutex presentMutex;
+  std::condition_variable presentCond;
+  // keeps SDL_PollEvent and the video calls of the present apart
+  std::mutex videoMutex;
+  std::thread presenter;
+
+  void startPresenter();
+  void stopPresenter();
+  void presentLoop();
+  void submitFrame();
+#endif
   FdaStreamer music;
   SDL_AudioSpec desiredAudioSpec;
   SDL_AudioSpec actualAudioSpec;
@@ -529,6 +939,7 @@ class DinoJump: private GameSettings {
   int jumpsLeft;
   bool duck;
   Obstacle obstacles[MAX_OBSTACLES];
+  CoverCache buildingCovers;
   int numObstacles;
   int difficulty;
   int score;
@@ -540,10 +951,14 @@ class DinoJump: private GameSettings {
 
   virtual int getDifficulty() override;
   virtual void setDifficulty(int val) override;
+  virtual bool getProfiling() override;
+  virtual void setProfiling(bool val) override;
   void resetGame();
+  void blitSprite(SDL_Surface *surface, const RleSprite *rle, SDL_Rect *src, SDL_Rect *dst);
   void drawCollider(const Collider &c, const Appearance &appearance);
   void drawGround();
   void render();
+  void presentScreen(SDL_Surface *frame);
   void update();
   void handleKeyEvent(const SDL_Event &event);
   void handleJoyHat(int32_t hatBits);
@@ -553,7 +968,7 @@ class DinoJump: private GameSettings {
     return SDL_MapRGB(screen->format, random() & 255 | 128, random() & 255 | 128, random() & 255 | 128);
   }
   void initAudio();
-  void initAssets();
+  bool initAssets();
   bool loadInputLayout(const char *fn);
 public:
   inline DinoJump():
@@ -561,6 +976,7 @@ public:
       running(false),
       frame(0),
       audioInitialized(false),
+      audioTraceId(-1),
       lastHatBits(0),
       activity(Activity::playing),
       random(micros()),
@@ -572,20 +988,31 @@ public:
       lastObstacleId(-1),
       difficulty(1),
       score(0),
+      presentBands(1),
+#ifdef PRESENT_THREAD
+      drawIndex(0),
+      screenBusy { false, false },
+      framePending(-1),
+      presenting(false),
+#endif
       music(mixer),
-      compressedMusic { .buffer = nullptr, .sizeInBytes = 0 },
       bestScore(0),
       overlay(320, 240, 0, true),
       menu(overlay, *this) {
   }
   ~DinoJump();
-  void init();
+  /// Returns false if the game can't run, after logging why
+  bool init();
   void run();
   void loop();
 };
 
 DinoJump::~DinoJump() {
-  compressedMusic.release();
+#ifdef PRESENT_THREAD
+  stopPresenter();
+#endif
+  music.stop();
+  assetPack.close();
 }
 
 int DinoJump::getDifficulty() {
@@ -598,15 +1025,38 @@ void DinoJump::setDifficulty(int val) {
 }
 
 
-void DinoJump::init() {
-  if (screen) return;
+bool DinoJump::getProfiling() {
+  return profiler.isEnabled();
+}
+
+void DinoJump::setProfiling(bool val) {
+  profiler.setEnabled(val);
+}
+
+bool DinoJump::init() {
+  if (screen) return true;
 
   std::cerr << "1.." << std::endl;
   SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_JOYSTICK);
 
+  // DINO_PROFILE=1 starts with the profiler on
+  if (const char *profile = getenv("DINO_PROFILE")) {
+    if (atoi(profile) > 0) profiler.setEnabled(true);
+  }
+
+  // the workers are only started here, so a TEST build of this file
+  // doesn't spawn threads when the global app is constructed
+  jobs.start();
+
   uint32_t flags = SDL_DOUBLEBUF | SDL_HWSURFACE;
   std::cerr << "2.." << std::endl;
 #if BLOWUP
+  // DINO_PRESENT_THREADS=n presents on n threads, 0 uses every core
+  if (const char *threads = getenv("DINO_PRESENT_THREADS")) {
+    presentBands = atoi(threads);
+    if (presentBands <= 0 || presentBands > jobs.numWorkers() + 1) presentBands = jobs.numWorkers() + 1;
+    std::cerr << "Presenting on " << presentBands << " threads" << std::endl;
+  }
 #ifdef VERTICAL
 #ifdef MIYOOA30
   realScreen = SDL_SetVideoMode(240 << BLOWUP, 320 << BLOWUP, 32, SDL_HWSURFACE | SDL_FULLSCREEN | SDL_DOUBLEBUF);
@@ -620,6 +1070,12 @@ void DinoJump::init() {
   screen = SDL_CreateRGBSurface(0, 320, 240, 32,
       realScreen->format->Rmask, realScreen->format->Gmask, realScreen->format->Bmask,
       realScreen->format->Amask);
+#ifdef PRESENT_THREAD
+  // DINO_PRESENT_LATENCY=1 presents on a separate thread
+  if (const char *latency = getenv("DINO_PRESENT_LATENCY")) {
+    if (atoi(latency) > 0) startPresenter();
+  }
+#endif
   std::cerr << "2.2.." << std::endl;
 #else
 #ifdef __EMSCRIPTEN__
@@ -629,6 +1085,16 @@ void DinoJump::init() {
 #endif
   screen = SDL_SetVideoMode(320, 240, 32, flags | additionalFlags);
 #endif
+  // page flipping and the pipelined present draw into two buffers in turn
+  int numBuffers = 1;
+#if BLOWUP
+#ifdef PRESENT_THREAD
+  if (presenting) numBuffers = 2;
+#endif
+#else
+  if (screen->flags & SDL_DOUBLEBUF) numBuffers = 2;
+#endif
+  dirty.reset(screen->w, screen->h, numBuffers);
 
 
   std::cerr << "3.." << std::endl;
@@ -674,7 +1140,7 @@ void DinoJump::init() {
   std::cerr << "4.." << std::endl;
   SDL_WM_SetCaption("Dino Jump", nullptr);
   SDL_ShowCursor(false);
-  initAssets();
+  return initAssets();
 }
 
 bool DinoJump::loadInputLayout(const char *path) {
@@ -695,26 +1161,58 @@ bool DinoJump::loadInputLayout(const char *path) {
     }
 }
 
-void DinoJump::initAssets() {
-  std::ifstream packFile("assets/assets.bin", std::ifstream::binary | std::ifstream::ate);
-  uint32_t size = packFile.tellg();
-  packFile.seekg(0);
-  AutoDeleteArray<char> buf(new char[size]);
-  packFile.read(buf, size);
-  packFile.close();
-  SlicedBuffer *bin = reinterpret_cast<SlicedBuffer*>(buf.asPointer());
+bool DinoJump::initAssets() {
+  // kept open for the life of the program so the music needs no copy of its own
+  uint32_t loadStart = micros();
+  if (!assetPack.open("assets/assets.bin")) {
+    std::cerr << "Could not load asset pack assets/assets.bin" << std::endl;
+    return false;
+  }
+  SlicedBuffer *bin = assetPack.pack();
+  // every job looks up a different slice, so the lazy deobfuscation
+  // in lookup never touches the same data from two threads
+  struct {
+    const char *fn;
+    SDL_Surface **surface;
+  } images[] = {
+    { "assets/vita.png", &vita },
+    { "assets/sky.png", &bg },
+    { "assets/ground.png", &ground },
+    { "assets/blimp.png", &blimp },
+    { "assets/building.png", &building },
+    { "assets/shadow.png", &shadow },
+  };
+  // one decode for all the sprites on the page, the rest come one by one
+  bool atlasLoaded = atlas.load(bin);
+  std::vector<SDL_Surface**> decoded;
+  for (auto &image: images) {
+    if (atlasLoaded && (*image.surface = atlas.sprite(image.fn))) continue;
+    decoded.push_back(image.surface);
+    // converted to the display format below, that has to be on this thread
+    jobs.add([bin, image] {
+      *image.surface = bin->loadPNG(image.fn, false);
+    });
+  }
+  // walks the frame headers, which pages in the whole music slice
+  jobs.add([this, bin] {
+    music.reset(bin->lookup("assets/80sloop.fda"));
+  });
+  jobs.wait();
+  for (SDL_Surface **surface: decoded) *surface = toDisplayFormat(*surface);
+  for (auto &image: images) {
+    if (!*image.surface) {
+      std::cerr << "Could not load " << image.fn << std::endl;
+      return false;
+    }
+  }
+  std::cerr << "Assets loaded in " << microDiff(loadStart, micros()) << " us using "
+      << jobs.numWorkers() << " workers" << std::endl;
   dino.appearance.color = randomBrightColor();
-  vita = bin->loadPNG("assets/vita.png");
   dino.appearance.surface = vita;
   dino.appearance.frameWidth = 24;
   dino.appearance.frameX = 4;
   dino.appearance.yOffset = 3;
   std::cerr << "5.." << std::endl;
-  bg = bin->loadPNG("assets/sky.png");
-  ground = bin->loadPNG("assets/ground.png");
-  blimp = bin->loadPNG("assets/blimp.png");
-  building = bin->loadPNG("assets/building.png");
-  shadow = bin->loadPNG("assets/shadow.png");
   std::cerr << "6.." << std::endl;
   const int widening = 2;
   wideShadow = SDL_CreateRGBSurface(0, shadow->w * widening, shadow-> h, 32,
@@ -749,10 +1247,23 @@ void DinoJump::initAssets() {
   SDL_SetAlpha(shadow, SDL_SRCALPHA, 255);
   SDL_SetAlpha(wideShadow, SDL_SRCALPHA, 255);
 
-  BufferView musicView = bin->lookup("assets/80sloop.fda");
-  compressedMusic.allocateAndCopy(musicView);
-  music.reset(compressedMusic);
+  struct {
+    SDL_Surface *surface;
+    RleSprite *rle;
+  } sprites[] = {
+    { vita, &vitaRle },
+    { ground, &groundRle },
+    { shadow, &shadowRle },
+    { wideShadow, &wideShadowRle },
+    { blimp, &blimpRle },
+  };
+  for (auto &sprite: sprites) {
+    if (canBlend(sprite.surface, screen)) sprite.rle->encode(sprite.surface);
+  }
+  dino.appearance.rle = &vitaRle;
+
   music.startPlaying();
+  return true;
 }
 
 
@@ -778,6 +1289,7 @@ void DinoJump::initAudio() {
   SDL_AudioDriverName(log, sizeof(log));
   std::cerr << "Audio driver: " << log << std::endl;
   std::cerr << "Opening audio device" << std::endl;
+  audioTraceId = trace::reserveThread("audio");
   if (SDL_OpenAudio(&desiredAudioSpec, &actualAudioSpec)) {
     std::cerr << "Failed to set up audio. Running without it." << std::endl;
     audioInitialized = true;
@@ -796,6 +1308,9 @@ void DinoJump::initAudio() {
 
 void DinoJump::loop() {
   SDL_Event event;
+#ifdef PRESENT_THREAD
+  std::unique_lock<std::mutex> videoLock(videoMutex);
+#endif
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
       case SDL_QUIT:
@@ -816,8 +1331,14 @@ void DinoJump::loop() {
         break;
     }
   }
+#ifdef PRESENT_THREAD
+  videoLock.unlock();
+#endif
 
-  update();
+  {
+    ProfileScope zone(profiler, ProfileZone::update);
+    update();
+  }
 
   render();
 }
@@ -825,23 +1346,34 @@ void DinoJump::loop() {
 void DinoJump::run() {
   running = true;
   std::cerr << "Entering main loop" << std::endl;
+  trace::setThreadName("game");
 
   while (running) {
     Timestamp frameStart;
 
-    loop();
+    {
+      ProfileScope zone(profiler, ProfileZone::frame);
+      loop();
+    }
 
     int32_t msLeft = 1000/60 - frameStart.elapsedSeconds()*1000.0f;
     if (msLeft > 0)
       SDL_Delay(msLeft);
   }
 
+#ifdef PRESENT_THREAD
+  stopPresenter();
+#endif
+  trace::finish();
   // Clean up
   SDL_Quit();
 }
 
 void callAudioCallback(void *userData, uint8_t *stream, int len) {
-  static_cast<DinoJump*>(userData)->mixer.audioCallback(stream, len);
+  DinoJump *game = static_cast<DinoJump*>(userData);
+  trace::attachThread(game->audioTraceId);
+  ProfileScope zone(game->profiler, ProfileZone::audio);
+  game->mixer.audioCallback(stream, len);
 }
 
 void DinoJump::handleJoyHat(int32_t hatBits) {
@@ -939,6 +1471,7 @@ void DinoJump::resetGame() {
   dino.resetPosition();
   numObstacles = 0;
   score = 0;
+  music.seek(0);
 }
 
 void DinoJump::update() {
@@ -965,12 +1498,14 @@ void DinoJump::update() {
         if (duckable) {
           obstacle.collider.y -= dino.duckHeight() * 5 / 4;
           appearance.surface = blimp;
+          appearance.rle = &blimpRle;
           appearance.frameWidth = 0;
           appearance.frameHeight = 0;
           appearance.yOffset = -2;
           appearance.flags &= ~Appearance::COVER6;
         } else {
           appearance.surface = building;
+          appearance.rle = nullptr;
           appearance.frameWidth = 12;
           appearance.frameHeight = 12;
           appearance.frameX = 0;
@@ -979,6 +1514,15 @@ void DinoJump::update() {
           appearance.coverWidth = max(3, (obstacle.collider.w+(24 << DP_SHIFT)) / 12 >> DP_SHIFT);
           appearance.coverHeight = max(2, (obstacle.collider.h+(12 << DP_SHIFT)) / 12 >> DP_SHIFT);
           appearance.yOffset = 0;
+          // drawn with a single blit when the composed surface is available
+          if (SDL_Surface *cover = buildingCovers.get(building, 12, 12,
+              appearance.coverWidth, appearance.coverHeight, obstacles, numObstacles, appearance.rle)) {
+            appearance.surface = cover;
+            if (!canBlend(cover, screen)) appearance.rle = nullptr;
+            appearance.frameWidth = 0;
+            appearance.frameHeight = 0;
+            appearance.flags &= ~Appearance::COVER6;
+          }
         }
         appearance.color = randomBrightColor();
         ++numObstacles;
@@ -1045,19 +1589,29 @@ void DinoJump::update() {
   ++frame;
 }
 
+void DinoJump::blitSprite(SDL_Surface *surface, const RleSprite *rle, SDL_Rect *src, SDL_Rect *dst) {
+  if (rle && !rle->empty()) {
+    rle->blit(src, screen, dst);
+  } else {
+    blendBlit(surface, src, screen, dst);
+  }
+}
+
 void DinoJump::drawCollider(const Collider &c, const Appearance &appearance) {
   int centerX = c.x + cx;
   int centerY = c.y + cy;
   SDL_Surface *surface = appearance.surface;
   if (appearance.flags & Appearance::SHADOW) {
-    SDL_Surface *shadowToUse = (c.w >> DP_SHIFT) > shadow->w ? wideShadow : shadow;
+    bool wide = (c.w >> DP_SHIFT) > shadow->w;
+    SDL_Surface *shadowToUse = wide ? wideShadow : shadow;
     int w = shadowToUse->w;
     int h = shadowToUse->h;
     SDL_Rect shadowDst {
       .x = static_cast<Sint16>((centerX >> DP_SHIFT) - w / 2),
       .y = static_cast<Sint16>((cy >> DP_SHIFT) - h / 2),
     };
-    SDL_BlitSurface(shadowToUse, nullptr, screen, &shadowDst);
+    blitSprite(shadowToUse, wide ? &wideShadowRle : &shadowRle, nullptr, &shadowDst);
+    dirty.add(shadowDst);
   }
   if (!surface) {
     int x1 = (centerX - (c.w >> 1)) >> DP_SHIFT;
@@ -1071,6 +1625,7 @@ void DinoJump::drawCollider(const Collider &c, const Appearance &appearance) {
       .h = static_cast<Uint16>(y2 - y1),
     };
     SDL_FillRect(screen, &r, appearance.color);
+    dirty.add(r);
   } else {
     int fw = appearance.frameWidth;
     int fh = appearance.frameHeight;
@@ -1090,6 +1645,7 @@ void DinoJump::drawCollider(const Collider &c, const Appearance &appearance) {
     }
     int bx = (centerX >> DP_SHIFT) - vw / 2 + appearance.xOffset;
     int by = (centerY + c.h / 2 >> DP_SHIFT) - vh + appearance.yOffset;
+    dirty.add(bx, by, vw, vh);
     for (int y = 0; y < ch; ++y) {
       int bs = bx;
       for (int x = 0; x < cw; ++x) {
@@ -1105,7 +1661,7 @@ void DinoJump::drawCollider(const Collider &c, const Appearance &appearance) {
           .w = static_cast<Uint16>(w),
           .h = static_cast<Uint16>(h),
         };
-        SDL_BlitSurface(surface, &src, screen, &dst);
+        blitSprite(surface, appearance.rle, &src, &dst);
         bx += w;
         fx = x >= cw - 2 ? 2 : 1;
       }
@@ -1121,85 +1677,156 @@ void DinoJump::drawGround() {
   backgroundOffset %= ground->w << DP_SHIFT;
   if (backgroundOffset < 0) backgroundOffset += ground->w << DP_SHIFT;
   int pixelOffset = backgroundOffset >> DP_SHIFT;
+  dirty.add(0, screen->h - ground->h, screen->w, ground->h);
   if (pixelOffset < screen->w) {
     SDL_Rect dstRect { .x = static_cast<Sint16>(pixelOffset), .y = static_cast<Sint16>(screen->h - ground->h) };
-    SDL_BlitSurface(ground, nullptr, screen, &dstRect);
+    blitSprite(ground, &groundRle, nullptr, &dstRect);
   }
   if (pixelOffset > 0) {
     SDL_Rect dstRect { .x = static_cast<Sint16>(pixelOffset-ground->w), .y = static_cast<Sint16>(screen->h - ground->h) };
-    SDL_BlitSurface(ground, nullptr, screen, &dstRect);
+    blitSprite(ground, &groundRle, nullptr, &dstRect);
   }
 }
 
 void DinoJump::render() {
-  SDL_BlitSurface(bg, nullptr, screen, nullptr);
-  drawGround();
-  for (int i = 0; i < numObstacles; ++i) {
-    const Obstacle *o = obstacles + i;
-    drawCollider(o->collider, o->appearance);
-  }
-  drawCollider(dino.collider, dino.appearance);
-  overlay.clear();
-  char str[256];
-  snprintf(str, sizeof(str), "Difficulty: %d", difficulty);
-  overlay.write(overlay.getNumColumns() - strnlen(str, sizeof(str)) - 1, 1, str);
-  snprintf(str, sizeof(str), "Score: %d", score);
-  overlay.write(1, 1, str);
-  snprintf(str, sizeof(str), " Best: %d", bestScore);
-  overlay.write(1, 2, str);
-  if (activity == Activity::menu) {
-    menu.render();
-  }
-  overlay.drawOverlay(screen);
+  {
+    ProfileScope zone(profiler, ProfileZone::background);
+    dirty.restore(bg, screen);
+    drawGround();
+  }
+  {
+    ProfileScope zone(profiler, ProfileZone::obstacles);
+    for (int i = 0; i < numObstacles; ++i) {
+      const Obstacle *o = obstacles + i;
+      drawCollider(o->collider, o->appearance);
+    }
+    drawCollider(dino.collider, dino.appearance);
+  }
+  {
+    ProfileScope zone(profiler, ProfileZone::overlay);
+    overlay.clear();
+    char str[64];
+    char *end = formatSigned(formatString(str, "Difficulty: "), difficulty);
+    overlay.write(overlay.getNumColumns() - (end - str) - 1, 1, str);
+    formatSigned(formatString(str, "Score: "), score);
+    overlay.write(1, 1, str);
+    formatSigned(formatString(str, " Best: "), bestScore);
+    overlay.write(1, 2, str);
+    if (profiler.isEnabled()) {
+      perf::Window window(overlay, 1, 4, overlay.getNumColumns() - 2, Profiler::NUM_ZONES + 1);
+      profiler.render(window);
+    }
+    if (activity == Activity::menu) {
+      menu.render();
+    }
+    overlay.drawOverlay(screen);
+    SDL_Rect textRects[DirtyRects::MAX_RECTS];
+    int numTextRects = overlay.getDirtyRects(textRects, DirtyRects::MAX_RECTS);
+    if (numTextRects > DirtyRects::MAX_RECTS) dirty.add(0, 0, screen->w, screen->h);
+    for (int i = 0; i < numTextRects && i < DirtyRects::MAX_RECTS; ++i) dirty.add(textRects[i]);
+  }
+#ifdef PRESENT_THREAD
+  if (presenting) {
+    submitFrame();
+    return;
+  }
+#endif
+  presentScreen(screen);
+}
+
+void DinoJump::presentScreen(SDL_Surface *frame) {
 #if BLOWUP
+#ifdef PRESENT_THREAD
+  std::lock_guard<std::mutex> videoLock(videoMutex);
+#endif
   SDL_LockSurface(realScreen);
-  SDL_LockSurface(screen);
-  uint32_t *sp = static_cast<uint32_t*>(screen->pixels);
-  int32_t spp = screen->pitch >> 2;
+  SDL_LockSurface(frame);
+  uint32_t *sp = static_cast<uint32_t*>(frame->pixels);
+  int32_t spp = frame->pitch >> 2;
   uint32_t *tp = static_cast<uint32_t*>(realScreen->pixels);
   int32_t tpp = realScreen->pitch >> 2;
 
 #ifdef VERTICAL
-  for (int x = 0; x < realScreen->w; ++x) {
-    uint32_t *source = sp + (x >> BLOWUP) * spp;
-    uint32_t *target = tp + x + tpp * (realScreen->h - 1);
-    for (int y = 0; y < realScreen->h; ++y) {
-      *target = source[y >> BLOWUP] | 0xFF000000u;
-      target -= tpp;
-    }
-  }
-#else
-
-#ifdef FLIP
-  uint32_t sw = screen->w;
-  uint32_t sh = screen->h;
-#endif
-
-  for (int y = 0; y < realScreen->h; ++y) {
-    uint32_t *target = tp;
-#ifdef FLIP
-    uint32_t *source = sp + (sh - (y >> BLOWUP) - 1) * spp;
+  const PresentLayout layout = PresentLayout::rotated;
+#elif defined(FLIP)
+  const PresentLayout layout = PresentLayout::flipped;
 #else
-    uint32_t *source = sp + (y >> BLOWUP) * spp;
+  const PresentLayout layout = PresentLayout::normal;
 #endif
-    for (int x = 0; x < realScreen->w; ++x) {
-#ifdef FLIP
-      *target++ = source[sw - (x >> BLOWUP) - 1] | 0xFF000000u;
-#else
-      *target++ = source[x >> BLOWUP];
-#endif
-    }
-    tp += tpp;
+  {
+    ProfileScope zone(profiler, ProfileZone::upscale);
+    present(layout, tp, tpp, sp, spp, frame->w, frame->h, BLOWUP, jobs, presentBands);
   }
-#endif
   SDL_UnlockSurface(realScreen);
-  SDL_UnlockSurface(screen);
+  SDL_UnlockSurface(frame);
+  ProfileScope zone(profiler, ProfileZone::flip);
   SDL_Flip(realScreen);
 #else
-  SDL_Flip(screen);
+  ProfileScope zone(profiler, ProfileZone::flip);
+  if (frame->flags & SDL_DOUBLEBUF) {
+    SDL_Flip(frame);
+  } else {
+    dirty.update(frame);
+  }
 #endif
 }
 
+#ifdef PRESENT_THREAD
+
+void DinoJump::startPresenter() {
+  screens[0] = screen;
+  screens[1] = SDL_CreateRGBSurface(0, screen->w, screen->h, 32,
+      screen->format->Rmask, screen->format->Gmask, screen->format->Bmask,
+      screen->format->Amask);
+  drawIndex = 0;
+  presenting = true;
+  presenter = std::thread(&DinoJump::presentLoop, this);
+  std::cerr << "Presenting on a separate thread" << std::endl;
+}
+
+void DinoJump::stopPresenter() {
+  if (!presenter.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(presentMutex);
+    presenting = false;
+  }
+  presentCond.notify_all();
+  presenter.join();
+  screen = screens[0];
+  SDL_FreeSurface(screens[1]);
+}
+
+void DinoJump::presentLoop() {
+  trace::setThreadName("present");
+  std::unique_lock<std::mutex> lock(presentMutex);
+  while (true) {
+    presentCond.wait(lock, [this] { return framePending >= 0 || !presenting; });
+    if (framePending < 0) return;
+    int index = framePending;
+    framePending = -1;
+    lock.unlock();
+    presentScreen(screens[index]);
+    lock.lock();
+    screenBusy[index] = false;
+    presentCond.notify_all();
+  }
+}
+
+void DinoJump::submitFrame() {
+  std::unique_lock<std::mutex> lock(presentMutex);
+  // the previous frame may not have been picked up yet
+  presentCond.wait(lock, [this] { return framePending < 0; });
+  screenBusy[drawIndex] = true;
+  framePending = drawIndex;
+  presentCond.notify_all();
+  drawIndex ^= 1;
+  // only waits when presenting takes longer than updating and drawing
+  presentCond.wait(lock, [this] { return !screenBusy[drawIndex]; });
+  screen = screens[drawIndex];
+}
+
+#endif
+
 DinoJump app;
 
 void mainLoop() {
@@ -1207,8 +1834,20 @@ void mainLoop() {
 }
 
 #ifndef TEST
-int main() {
-  app.init();
+int main(int argc, char **argv) {
+  // DINO_TRACE=file or --trace [file] records a Chrome trace,
+  // written when the game quits
+  const char *tracePath = getenv("DINO_TRACE");
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--trace")) continue;
+    tracePath = i + 1 < argc && argv[i + 1][0] != '-' ? argv[++i] : "dino_trace.json";
+  }
+  if (tracePath && *tracePath) trace::start(tracePath);
+
+  if (!app.init()) {
+    SDL_Quit();
+    return 1;
+  }
 
 #ifdef __EMSCRIPTEN__
   emscripten_set_main_loop(mainLoop, 0, 1);
@@ -0,0 +1,84 @@
+#include "dirty.hh"
+#include "blit.hh"
+
+DirtyRects::DirtyRects(): current(0), numBuffers(1), width(0), height(0) {
+  invalidate();
+  restored.numRects = 0;
+  restored.full = true;
+}
+
+void DirtyRects::reset(int newWidth, int newHeight, int newNumBuffers) {
+  width = newWidth;
+  height = newHeight;
+  if (newNumBuffers < 1) newNumBuffers = 1;
+  if (newNumBuffers > MAX_BUFFERS) newNumBuffers = MAX_BUFFERS;
+  numBuffers = newNumBuffers;
+  current = 0;
+  invalidate();
+}
+
+void DirtyRects::invalidate() {
+  for (int i = 0; i < MAX_BUFFERS; ++i) {
+    frames[i].numRects = 0;
+    frames[i].full = true;
+  }
+}
+
+void DirtyRects::add(int x, int y, int w, int h) {
+  Frame &f = frames[current];
+  if (f.full) return;
+  int x2 = x + w;
+  int y2 = y + h;
+  if (x < 0) x = 0;
+  if (y < 0) y = 0;
+  if (x2 > width) x2 = width;
+  if (y2 > height) y2 = height;
+  if (x >= x2 || y >= y2) return;
+  if (f.numRects >= MAX_RECTS) {
+    f.full = true;
+    return;
+  }
+  SDL_Rect &r = f.rects[f.numRects++];
+  r.x = x;
+  r.y = y;
+  r.w = x2 - x;
+  r.h = y2 - y;
+}
+
+void DirtyRects::restoreFrame(const Frame &f, SDL_Surface *bg, SDL_Surface *screen) {
+  for (int i = 0; i < f.numRects; ++i) {
+    // blitting clips the destination rect in place
+    SDL_Rect src = f.rects[i];
+    SDL_Rect dst = f.rects[i];
+    blendBlit(bg, &src, screen, &dst);
+  }
+}
+
+void DirtyRects::restore(SDL_Surface *bg, SDL_Surface *screen) {
+  current = current + 1 < numBuffers ? current + 1 : 0;
+  bool full = false;
+  for (int i = 0; i < numBuffers; ++i) full |= frames[i].full;
+  if (full) {
+    blendBlit(bg, nullptr, screen, nullptr);
+  } else {
+    for (int i = 0; i < numBuffers; ++i) restoreFrame(frames[i], bg, screen);
+  }
+  // the oldest frame becomes the current one
+  restored = frames[current];
+  restored.full = full;
+  frames[current].numRects = 0;
+  frames[current].full = false;
+}
+
+void DirtyRects::update(SDL_Surface *screen) {
+  const Frame &f = frames[current];
+  if (restored.full || f.full || restored.numRects + f.numRects > MAX_RECTS) {
+    SDL_UpdateRect(screen, 0, 0, 0, 0);
+    return;
+  }
+  SDL_Rect rects[MAX_RECTS];
+  int n = 0;
+  for (int i = 0; i < restored.numRects; ++i) rects[n++] = restored.rects[i];
+  for (int i = 0; i < f.numRects; ++i) rects[n++] = f.rects[i];
+  SDL_UpdateRects(screen, n, rects);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <SDL/SDL.h>
+#include <stdint.h>
+
+/// Keeps track of the parts of the screen drawn over in the last few
+/// frames, so the next frame only has to restore those from the
+/// background instead of blitting the whole background.
+///
+/// numBuffers is how many frames go by before the same screen buffer
+/// is drawn into again (two for page flipping or the pipelined present).
+/// Everything drawn in that many previous frames is restored, which is
+/// also correct when the buffer comes back sooner.
+class DirtyRects {
+public:
+  static const int MAX_RECTS = 64;
+  static const int MAX_BUFFERS = 3;
+private:
+  struct Frame {
+    SDL_Rect rects[MAX_RECTS];
+    int numRects;
+    // everything has to be restored, either because the
+    // buffer content is unknown or because rects ran out
+    bool full;
+  };
+  Frame frames[MAX_BUFFERS];
+  // what the last restore covered, to update the display with
+  Frame restored;
+  int current;
+  int numBuffers;
+  int width;
+  int height;
+
+  static void restoreFrame(const Frame &f, SDL_Surface *bg, SDL_Surface *screen);
+public:
+  DirtyRects();
+
+  /// Sets the screen size and the number of buffers, the next
+  /// frames restore the whole screen
+  void reset(int newWidth, int newHeight, int newNumBuffers);
+
+  /// The next frames restore the whole screen
+  void invalidate();
+
+  /// Marks an area of the current frame as drawn,
+  /// it is clipped to the screen
+  void add(int x, int y, int w, int h);
+
+  inline void add(const SDL_Rect &r) {
+    add(r.x, r.y, r.w, r.h);
+  }
+
+  /// Starts a new frame: restores every area drawn since the buffer
+  /// was last used from bg, which has to be the size of the screen
+  void restore(SDL_Surface *bg, SDL_Surface *screen);
+
+  /// Updates the parts of a single buffered display surface that
+  /// changed since the previous frame, instead of SDL_Flip.
+  /// Only valid with one buffer.
+  void update(SDL_Surface *screen);
+};
@@ -156,7 +156,9 @@ void *fda_encode(const short *sample_data, fda_desc *fda, unsigned int *out_len)
 
 unsigned int fda_max_frame_size(fda_desc *fda);
 unsigned int fda_decode_header(const unsigned char *bytes, int size, fda_desc *fda);
+unsigned int fda_index_frames(const unsigned char *bytes, unsigned int size, unsigned int *offsets, unsigned int max_frames);
 unsigned int fda_decode_frame(const unsigned char *bytes, unsigned int size, fda_desc *fda, short *sample_data, unsigned int *frame_len);
+unsigned int fda_decode_frame_fast(const unsigned char *bytes, unsigned int size, fda_desc *fda, short *sample_data, unsigned int *frame_len);
 short *fda_decode(const unsigned char *bytes, int size, fda_desc *file);
 
 #ifndef FDA_NO_STDIO
@@ -179,6 +181,18 @@ void *fda_read(const char *filename, fda_desc *fda);
 #ifdef FDA_IMPLEMENTATION
 #include <stdlib.h>
 
+/* Define FDA_SIMD to have the fast stereo decoder keep the LMS state in
+SSE4.1 vectors (x86, checked at runtime, as the desktop build does not
+target SSE4.1). It is off by default: the 4 tap filter is a serial chain,
+and the horizontal add plus the move back to a general register end up on
+the critical path. On x86 (-O3) 80sloop.fda decodes in ~10.7 ms with
+SSE4.1, ~8.4 ms with the unrolled scalar version and ~9.1 ms with
+fda_decode_frame (~21.5 ms at -O2). */
+#if defined(FDA_SIMD) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+	#define FDA_SSE41
+	#include <smmintrin.h>
+#endif
+
 #ifndef FDA_MALLOC
 	#define FDA_MALLOC(sz) malloc(sz)
 	#define FDA_FREE(p) free(p)
@@ -577,9 +591,33 @@ unsigned int fda_decode_header(const unsigned char *bytes, int size, fda_desc *f
 	return 8;
 }
 
-unsigned int fda_decode_frame(const unsigned char *bytes, unsigned int size, fda_desc *fda, short *sample_data, unsigned int *frame_len) {
+/* Walk the frame headers after the file header and store the byte offset of
+each frame in offsets, up to max_frames. Returns the number of frames found.
+Every frame but the last holds FDA_FRAME_LEN samples per channel and carries
+its own LMS state, so frame i starts at sample i * FDA_FRAME_LEN and can be
+decoded without touching the frames before it. */
+unsigned int fda_index_frames(const unsigned char *bytes, unsigned int size, unsigned int *offsets, unsigned int max_frames) {
+	unsigned int p = 8;
+	unsigned int num_frames = 0;
+
+	while (num_frames < max_frames && p + 8 <= size) {
+		unsigned int q = p;
+		fda_uint64_t frame_header = fda_read_u64(bytes, &q);
+		unsigned int frame_size = frame_header & 0x00ffff;
+		if (frame_size <= 8 || frame_size > size - p) {
+			break;
+		}
+		offsets[num_frames++] = p;
+		p += frame_size;
+	}
+	return num_frames;
+}
+
+/* Reads and verifies the frame header and the LMS state of every channel.
+Returns the number of bytes read and the number of samples per channel in
+the frame, or 0 if the frame is invalid. */
+static unsigned int fda_decode_frame_start(const unsigned char *bytes, unsigned int size, fda_desc *fda, unsigned int *frame_samples) {
 	unsigned int p = 0;
-	*frame_len = 0;
 
 	if (size < 8 + FDA_LMS_LEN * 4 * fda->channels) {
 		return 0;
@@ -618,6 +656,19 @@ unsigned int fda_decode_frame(const unsigned char *bytes, unsigned int size, fda
 		}
 	}
 
+	*frame_samples = samples;
+	return p;
+}
+
+unsigned int fda_decode_frame(const unsigned char *bytes, unsigned int size, fda_desc *fda, short *sample_data, unsigned int *frame_len) {
+	unsigned int samples;
+	unsigned int channels = fda->channels;
+	*frame_len = 0;
+
+	unsigned int p = fda_decode_frame_start(bytes, size, fda, &samples);
+	if (!p) {
+		return 0;
+	}
 
 	/* Decode all slices for all channels in this frame */
 	for (unsigned int sample_index = 0; sample_index < samples; sample_index += FDA_SLICE_LEN) {
@@ -646,6 +697,139 @@ unsigned int fda_decode_frame(const unsigned char *bytes, unsigned int size, fda
 	return p;
 }
 
+
+/* The fast decoder handles stereo, which is what the game uses. The two
+channels are independent, so decoding them in the same loop gives the CPU
+two dependency chains to interleave. The LMS state of both channels stays
+in registers for the whole frame, and full slices run a fixed length loop
+the compiler can unroll. It produces exactly the same samples as
+fda_decode_frame (the gentool fdacheck command verifies this). */
+
+#define FDA_STEREO_SLICE(step_l, step_r) \
+	for (unsigned int sample_index = 0; sample_index < samples; sample_index += FDA_SLICE_LEN) { \
+		fda_uint64_t slice_l = fda_read_u64(bytes, &p); \
+		fda_uint64_t slice_r = fda_read_u64(bytes, &p); \
+		const int *dq_l = fda_dequant_tab[(slice_l >> 60) & 0xf]; \
+		const int *dq_r = fda_dequant_tab[(slice_r >> 60) & 0xf]; \
+		short *out = sample_data + sample_index * 2; \
+		if (sample_index + FDA_SLICE_LEN <= samples) { \
+			for (int i = 0; i < FDA_SLICE_LEN; i++) { \
+				step_l; step_r; out += 2; \
+			} \
+		} else { \
+			for (unsigned int i = sample_index; i < samples; i++) { \
+				step_l; step_r; out += 2; \
+			} \
+		} \
+	}
+
+static inline int fda_step_scalar(int *h, int *w, const int *dq, fda_uint64_t *slice) {
+	int predicted = (w[0] * h[0] + w[1] * h[1] + w[2] * h[2] + w[3] * h[3]) >> 13;
+	int dequantized = dq[(*slice >> 57) & 0x7];
+	int reconstructed = fda_clamp_s16(predicted + dequantized);
+	int delta = dequantized >> 4;
+	*slice <<= 3;
+
+	w[0] += h[0] < 0 ? -delta : delta;
+	w[1] += h[1] < 0 ? -delta : delta;
+	w[2] += h[2] < 0 ? -delta : delta;
+	w[3] += h[3] < 0 ? -delta : delta;
+	h[0] = h[1];
+	h[1] = h[2];
+	h[2] = h[3];
+	h[3] = reconstructed;
+	return reconstructed;
+}
+
+static unsigned int fda_decode_stereo_scalar(const unsigned char *bytes, unsigned int p, fda_desc *fda, short *sample_data, unsigned int samples) {
+	int hl[4], wl[4], hr[4], wr[4];
+	for (int i = 0; i < FDA_LMS_LEN; i++) {
+		hl[i] = fda->lms[0].history[i];
+		wl[i] = fda->lms[0].weights[i];
+		hr[i] = fda->lms[1].history[i];
+		wr[i] = fda->lms[1].weights[i];
+	}
+	FDA_STEREO_SLICE(
+		out[0] = fda_step_scalar(hl, wl, dq_l, &slice_l),
+		out[1] = fda_step_scalar(hr, wr, dq_r, &slice_r))
+	for (int i = 0; i < FDA_LMS_LEN; i++) {
+		fda->lms[0].history[i] = hl[i];
+		fda->lms[0].weights[i] = wl[i];
+		fda->lms[1].history[i] = hr[i];
+		fda->lms[1].weights[i] = wr[i];
+	}
+	return p;
+}
+
+#if defined(FDA_SSE41)
+
+#define FDA_SSE41_FN __attribute__((target("sse4.1")))
+
+static inline FDA_SSE41_FN int fda_step_sse41(__m128i *h, __m128i *w, const int *dq, fda_uint64_t *slice) {
+	__m128i prod = _mm_mullo_epi32(*w, *h);
+	__m128i sum = _mm_add_epi32(prod, _mm_shuffle_epi32(prod, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	int predicted = _mm_cvtsi128_si32(sum) >> 13;
+	int dequantized = dq[(*slice >> 57) & 0x7];
+	int reconstructed = fda_clamp_s16(predicted + dequantized);
+	*slice <<= 3;
+
+	/* sign is -1 for negative history samples, (delta ^ -1) - -1 == -delta */
+	__m128i delta = _mm_set1_epi32(dequantized >> 4);
+	__m128i sign = _mm_srai_epi32(*h, 31);
+	*w = _mm_add_epi32(*w, _mm_sub_epi32(_mm_xor_si128(delta, sign), sign));
+	*h = _mm_insert_epi32(_mm_srli_si128(*h, 4), reconstructed, 3);
+	return reconstructed;
+}
+
+static FDA_SSE41_FN unsigned int fda_decode_stereo_simd(const unsigned char *bytes, unsigned int p, fda_desc *fda, short *sample_data, unsigned int samples) {
+	__m128i hl = _mm_loadu_si128((const __m128i *)fda->lms[0].history);
+	__m128i wl = _mm_loadu_si128((const __m128i *)fda->lms[0].weights);
+	__m128i hr = _mm_loadu_si128((const __m128i *)fda->lms[1].history);
+	__m128i wr = _mm_loadu_si128((const __m128i *)fda->lms[1].weights);
+	FDA_STEREO_SLICE(
+		out[0] = fda_step_sse41(&hl, &wl, dq_l, &slice_l),
+		out[1] = fda_step_sse41(&hr, &wr, dq_r, &slice_r))
+	_mm_storeu_si128((__m128i *)fda->lms[0].history, hl);
+	_mm_storeu_si128((__m128i *)fda->lms[0].weights, wl);
+	_mm_storeu_si128((__m128i *)fda->lms[1].history, hr);
+	_mm_storeu_si128((__m128i *)fda->lms[1].weights, wr);
+	return p;
+}
+
+#endif
+
+unsigned int fda_decode_frame_fast(const unsigned char *bytes, unsigned int size, fda_desc *fda, short *sample_data, unsigned int *frame_len) {
+	unsigned int samples;
+	*frame_len = 0;
+
+	if (fda->channels != 2) {
+		return fda_decode_frame(bytes, size, fda, sample_data, frame_len);
+	}
+
+	unsigned int p = fda_decode_frame_start(bytes, size, fda, &samples);
+	if (!p) {
+		return 0;
+	}
+
+	#if defined(FDA_SSE41)
+		static int has_sse41 = -1;
+		if (has_sse41 < 0) {
+			has_sse41 = __builtin_cpu_supports("sse4.1") ? 1 : 0;
+		}
+		if (has_sse41) {
+			p = fda_decode_stereo_simd(bytes, p, fda, sample_data, samples);
+		} else {
+			p = fda_decode_stereo_scalar(bytes, p, fda, sample_data, samples);
+		}
+	#else
+		p = fda_decode_stereo_scalar(bytes, p, fda, sample_data, samples);
+	#endif
+
+	*frame_len = samples;
+	return p;
+}
+
 short *fda_decode(const unsigned char *bytes, int size, fda_desc *fda) {
 	unsigned int p = fda_decode_header(bytes, size, fda);
 	if (!p) {
@@ -0,0 +1,119 @@
+#include "format.hh"
+
+namespace {
+
+/// The two digits of every number below 100
+struct DigitPairs {
+  char digits[200];
+
+  DigitPairs() {
+    for (int i = 0; i < 100; ++i) {
+      digits[i * 2] = '0' + i / 10;
+      digits[i * 2 + 1] = '0' + i % 10;
+    }
+  }
+};
+
+const DigitPairs digitPairs;
+
+const uint64_t powersOf10[] = {
+  1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+inline int countDigits(uint64_t n) {
+  int count = 1;
+  for (;;) {
+    if (n < 10) return count;
+    if (n < 100) return count + 1;
+    if (n < 1000) return count + 2;
+    if (n < 10000) return count + 3;
+    n /= 10000;
+    count += 4;
+  }
+}
+
+/// Writes the last count digits of n ending at end, zero padded
+inline void writeDigits(char *end, uint64_t n, int count) {
+  // two digits at a time, while 32 bit divisions do
+  while (count >= 2 && n > UINT32_MAX) {
+    const char *pair = digitPairs.digits + (n % 100) * 2;
+    n /= 100;
+    *--end = pair[1];
+    *--end = pair[0];
+    count -= 2;
+  }
+  uint32_t m = n;
+  for (; count >= 2; count -= 2) {
+    const char *pair = digitPairs.digits + (m % 100) * 2;
+    m /= 100;
+    *--end = pair[1];
+    *--end = pair[0];
+  }
+  if (count) *--end = '0' + m % 10;
+}
+
+}
+
+char* formatString(char *dst, const char *str) {
+  while (*str) *dst++ = *str++;
+  *dst = 0;
+  return dst;
+}
+
+char* formatUnsigned(char *dst, uint64_t n) {
+  int count = countDigits(n);
+  dst += count;
+  writeDigits(dst, n, count);
+  *dst = 0;
+  return dst;
+}
+
+char* formatSigned(char *dst, int64_t n) {
+  if (n < 0) {
+    *dst++ = '-';
+    // negated as unsigned, so the minimum value works too
+    return formatUnsigned(dst, -static_cast<uint64_t>(n));
+  }
+  return formatUnsigned(dst, n);
+}
+
+char* formatFixed(char *dst, int64_t value, int decimals) {
+  if (decimals <= 0) return formatSigned(dst, value);
+  if (decimals > 9) decimals = 9;
+  uint64_t n = value;
+  if (value < 0) {
+    *dst++ = '-';
+    n = -n;
+  }
+  uint64_t scale = powersOf10[decimals];
+  dst = formatUnsigned(dst, n / scale);
+  *dst++ = '.';
+  dst += decimals;
+  writeDigits(dst, n % scale, decimals);
+  *dst = 0;
+  return dst;
+}
+
+char* formatFloat(char *dst, double v, int decimals) {
+  if (v != v) return formatString(dst, "nan");
+  if (decimals < 0) decimals = 0;
+  if (decimals > 9) decimals = 9;
+  double scaled = v * powersOf10[decimals];
+  if (scaled >= 9.2e18 || scaled <= -9.2e18) {
+    // only infinities stay infinite when subtracted from themselves
+    if (v - v != 0) return formatString(dst, v > 0 ? "inf" : "-inf");
+    return formatString(dst, "ovf");
+  }
+  int64_t value = static_cast<int64_t>(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+  return formatFixed(dst, value, decimals);
+}
+
+char* alignRight(char *start, char *end, int width) {
+  int length = end - start;
+  if (length >= width) return end;
+  int spaces = width - length;
+  // moving back to front, the zero included
+  for (char *p = end; p >= start; --p) p[spaces] = *p;
+  for (int i = 0; i < spaces; ++i) start[i] = ' ';
+  return end + spaces;
+}
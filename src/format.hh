@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+/// Number formatting without libc calls, cheap enough to redo
+/// every frame. The functions write the text at dst and return
+/// a pointer to the terminating zero they put after it, so calls
+/// can be chained to build a line.
+
+/// The most characters a formatted 64 bit integer takes, sign included
+const int MAX_DECIMAL_LENGTH = 20;
+
+/// Copies str to dst
+char* formatString(char *dst, const char *str);
+
+char* formatUnsigned(char *dst, uint64_t n);
+char* formatSigned(char *dst, int64_t n);
+
+/// Formats value / 10^decimals with exactly that many decimals,
+/// so 12345 with 3 decimals is 12.345 (decimals is at most 9)
+char* formatFixed(char *dst, int64_t value, int decimals);
+
+/// Formats v rounded to the given number of decimals (at most 9),
+/// "inf" or "nan" for those, and "ovf" if it doesn't fit
+/// in 64 bits at that precision
+char* formatFloat(char *dst, double v, int decimals);
+
+/// Pads the text from start to end with spaces on the left so it
+/// is width characters long, returns the new end. There has to be
+/// room for width characters and the terminating zero.
+char* alignRight(char *start, char *end, int width);
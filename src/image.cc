@@ -1,26 +1,28 @@
 #include "image.hh"
+#include "lz4.hh"
 
 #include <stdio.h>
+#include <string.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-static SDL_Surface* finishLoad(unsigned char *data, int width, int height, int channels);
+static SDL_Surface* finishLoad(unsigned char *data, int width, int height, int channels, bool convert);
 
 SDL_Surface* loadPNG(const char* filename) {
     int width, height, channels;
     unsigned char *data = stbi_load(filename, &width, &height, &channels, STBI_rgb_alpha);
 
-    return finishLoad(data, width, height, channels);
+    return finishLoad(data, width, height, channels, true);
 }
 
-SDL_Surface* loadPNGFromMemory(const void* contents, int size) {
+SDL_Surface* loadPNGFromMemory(const void* contents, int size, bool convert) {
     int width, height, channels;
     unsigned char *data = stbi_load_from_memory(reinterpret_cast<const unsigned char*>(contents), size, &width, &height, &channels, STBI_rgb_alpha);
 
-    return finishLoad(data, width, height, channels);
+    return finishLoad(data, width, height, channels, convert);
 }
 
-static SDL_Surface* finishLoad(unsigned char *data, int width, int height, int channels) {
+static SDL_Surface* finishLoad(unsigned char *data, int width, int height, int channels, bool convert) {
     if (data == NULL) {
         fprintf(stderr, "Failed to load image: %s\n", stbi_failure_reason());
         return NULL;
@@ -45,6 +47,24 @@ static SDL_Surface* finishLoad(unsigned char *data, int width, int height, int c
         return NULL;
     }
 
+    if (!convert) {
+        // a copy that owns its pixels, converted later on the main thread
+        SDL_Surface *copy = SDL_CreateRGBSurface(SDL_SWSURFACE, width, height, 32,
+            0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000);
+        if (copy) {
+            SDL_LockSurface(copy);
+            for (int y = 0; y < height; ++y) {
+                memcpy(static_cast<uint8_t*>(copy->pixels) + y * copy->pitch, data + y * width * 4, width * 4);
+            }
+            SDL_UnlockSurface(copy);
+        } else {
+            fprintf(stderr, "Failed to create SDL surface: %s\n", SDL_GetError());
+        }
+        SDL_FreeSurface(surface);
+        stbi_image_free(data);
+        return copy;
+    }
+
     // Free the original data when the SDL_Surface is freed
     SDL_Surface* optimizedSurface = SDL_DisplayFormatAlpha(surface);
     SDL_FreeSurface(surface);
@@ -52,3 +72,72 @@ static SDL_Surface* finishLoad(unsigned char *data, int width, int height, int c
 
     return optimizedSurface;
 }
+
+// the masks SDL_DisplayFormatAlpha would convert to
+static bool matchesDisplayFormatAlpha(Uint32 Rmask, Uint32 Gmask, Uint32 Bmask, Uint32 Amask) {
+    SDL_Surface *video = SDL_GetVideoSurface();
+    if (!video) return false;
+    const SDL_PixelFormat *vf = video->format;
+    Uint32 rmask = 0x00ff0000;
+    Uint32 bmask = 0x000000ff;
+    if ((vf->BytesPerPixel == 2 && vf->Rmask == 0x1f && (vf->Bmask == 0xf800 || vf->Bmask == 0x7c00)) ||
+            (vf->BytesPerPixel == 4 && vf->Rmask == 0xff && vf->Bmask == 0xff0000)) {
+        rmask = 0x000000ff;
+        bmask = 0x00ff0000;
+    }
+    return Rmask == rmask && Gmask == 0x0000ff00 && Bmask == bmask && Amask == 0xff000000;
+}
+
+SDL_Surface* toDisplayFormat(SDL_Surface *surface) {
+    if (!surface) return NULL;
+    const SDL_PixelFormat *f = surface->format;
+    if (f->BitsPerPixel == 32 && matchesDisplayFormatAlpha(f->Rmask, f->Gmask, f->Bmask, f->Amask)) return surface;
+    SDL_Surface* optimizedSurface = SDL_DisplayFormatAlpha(surface);
+    SDL_FreeSurface(surface);
+    return optimizedSurface;
+}
+
+SDL_Surface* loadPixelPayload(void* contents, int size, bool convert) {
+    PixelPayload *payload = reinterpret_cast<PixelPayload*>(contents);
+    if (size < (int)sizeof(PixelPayload) || payload->magic != PixelPayload::MAGIC ||
+            payload->dataSize > size - sizeof(PixelPayload)) {
+        fprintf(stderr, "Invalid pixel payload\n");
+        return NULL;
+    }
+    uint32_t pixelBytes = payload->width * payload->height * 4;
+    SDL_Surface *surface;
+    if (payload->flags & PixelPayload::FLAG_LZ4) {
+        surface = SDL_CreateRGBSurface(SDL_SWSURFACE, payload->width, payload->height, 32,
+            payload->Rmask, payload->Gmask, payload->Bmask, payload->Amask);
+        if (surface == NULL) {
+            fprintf(stderr, "Failed to create SDL surface: %s\n", SDL_GetError());
+            return NULL;
+        }
+        // 32 bit surfaces have no padding, so the pixels go straight in
+        SDL_LockSurface(surface);
+        uint32_t decoded = lz4Decompress(reinterpret_cast<const uint8_t*>(payload->data), payload->dataSize,
+            static_cast<uint8_t*>(surface->pixels), surface->pitch * surface->h);
+        SDL_UnlockSurface(surface);
+        if (decoded != pixelBytes || surface->pitch != (int)payload->width * 4) {
+            fprintf(stderr, "Failed to decompress pixel payload\n");
+            SDL_FreeSurface(surface);
+            return NULL;
+        }
+    } else {
+        if (payload->dataSize < pixelBytes) {
+            fprintf(stderr, "Pixel payload is truncated\n");
+            return NULL;
+        }
+        surface = SDL_CreateRGBSurfaceFrom(payload->data, payload->width, payload->height, 32,
+            payload->width * 4, payload->Rmask, payload->Gmask, payload->Bmask, payload->Amask);
+        if (surface == NULL) {
+            fprintf(stderr, "Failed to create SDL surface: %s\n", SDL_GetError());
+            return NULL;
+        }
+    }
+    if (!convert || matchesDisplayFormatAlpha(payload->Rmask, payload->Gmask, payload->Bmask, payload->Amask)) return surface;
+    // packed for a different display, still no PNG decode though
+    SDL_Surface* optimizedSurface = SDL_DisplayFormatAlpha(surface);
+    SDL_FreeSurface(surface);
+    return optimizedSurface;
+}
@@ -1,5 +1,31 @@
 #pragma once
+#include <stdint.h>
 #include <SDL/SDL.h>
 
+/// Sprite decoded ahead of time by gentool: 32 bit pixels with the given
+/// masks and a pitch of width * 4, LZ4 compressed when FLAG_LZ4 is set.
+struct PixelPayload {
+    static const uint32_t MAGIC = 0x58495044; // 'DPIX'
+    static const uint32_t FLAG_LZ4 = 1;
+
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    uint32_t Rmask, Gmask, Bmask, Amask;
+    uint32_t flags;
+    uint32_t dataSize;
+    uint32_t data[0];
+};
+
+/// The loaders return surfaces in the display format. With convert set
+/// to false they skip the conversion, as SDL_DisplayFormatAlpha is a video
+/// call that only works on the main thread, and toDisplayFormat has to
+/// be called on the result there.
 SDL_Surface* loadPNG(const char* filename);
-SDL_Surface* loadPNGFromMemory(const void* contents, int size);
+SDL_Surface* loadPNGFromMemory(const void* contents, int size, bool convert = true);
+/// Creates a surface for a PixelPayload, uncompressed pixels are used in
+/// place so contents has to outlive the surface
+SDL_Surface* loadPixelPayload(void* contents, int size, bool convert = true);
+/// Converts a loaded surface to the display format with alpha, freeing
+/// the original, unless it is in that format already. Main thread only.
+SDL_Surface* toDisplayFormat(SDL_Surface *surface);
@@ -0,0 +1,86 @@
+#include "jobs.hh"
+
+#ifndef __EMSCRIPTEN__
+
+JobPool::JobPool(): unfinished(0), stopping(false) { }
+
+void JobPool::start(int numWorkers) {
+  if (!workers.empty()) return;
+  if (numWorkers < 0) numWorkers = static_cast<int>(std::thread::hardware_concurrency()) - 1;
+  for (int i = 0; i < numWorkers; ++i) {
+    workers.emplace_back(&JobPool::workerLoop, this);
+  }
+}
+
+JobPool::~JobPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  jobAdded.notify_all();
+  for (std::thread &worker: workers) worker.join();
+}
+
+void JobPool::add(std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(std::move(job));
+    ++unfinished;
+  }
+  jobAdded.notify_one();
+}
+
+void JobPool::workerLoop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    jobAdded.wait(lock, [this] { return stopping || !queue.empty(); });
+    if (queue.empty()) return;
+    std::function<void()> job = std::move(queue.front());
+    queue.pop_front();
+    lock.unlock();
+    job();
+    lock.lock();
+    if (!--unfinished) jobFinished.notify_all();
+  }
+}
+
+void JobPool::wait() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (unfinished) {
+    if (queue.empty()) {
+      jobFinished.wait(lock);
+      continue;
+    }
+    // help out instead of just waiting
+    std::function<void()> job = std::move(queue.front());
+    queue.pop_front();
+    lock.unlock();
+    job();
+    lock.lock();
+    if (!--unfinished) jobFinished.notify_all();
+  }
+}
+
+#else
+
+JobPool::JobPool(): unfinished(0) { }
+
+void JobPool::start(int /*numWorkers*/) { }
+
+JobPool::~JobPool() { }
+
+void JobPool::add(std::function<void()> job) {
+  queue.push_back(std::move(job));
+  ++unfinished;
+}
+
+void JobPool::wait() {
+  while (!queue.empty()) {
+    std::function<void()> job = std::move(queue.front());
+    queue.pop_front();
+    job();
+    --unfinished;
+  }
+}
+
+#endif
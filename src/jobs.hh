@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#ifndef __EMSCRIPTEN__
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif
+
+/// A few worker threads running queued jobs. The thread calling wait()
+/// runs jobs too, so without workers (single core, Emscripten) every
+/// job runs inside wait() on the calling thread.
+class JobPool {
+  std::deque<std::function<void()>> queue;
+  uint32_t unfinished;
+#ifndef __EMSCRIPTEN__
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable jobAdded;
+  std::condition_variable jobFinished;
+  bool stopping;
+
+  void workerLoop();
+#endif
+public:
+  /// Starts without workers, see start
+  JobPool();
+  ~JobPool();
+
+  /// Starts the worker threads, a negative number of workers means
+  /// one less than the number of cores. Only does anything once.
+  void start(int numWorkers = -1);
+
+  void add(std::function<void()> job);
+  /// Returns once every job added so far has finished
+  void wait();
+
+  inline int numWorkers() const {
+#ifndef __EMSCRIPTEN__
+    return workers.size();
+#else
+    return 0;
+#endif
+  }
+};
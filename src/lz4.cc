@@ -0,0 +1,121 @@
+#include "lz4.hh"
+#include <string.h>
+
+namespace {
+
+const uint32_t MIN_MATCH = 4;
+// the format wants the last 5 bytes as literals and no match
+// starting in the last 12 bytes
+const uint32_t LAST_LITERALS = 5;
+const uint32_t MATCH_LIMIT = 12;
+const uint32_t MAX_OFFSET = 65535;
+const int HASH_BITS = 12;
+
+inline uint32_t read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+inline uint32_t hashSequence(uint32_t seq) {
+  return (seq * 2654435761U) >> (32 - HASH_BITS);
+}
+
+inline uint8_t* writeLength(uint8_t *op, uint32_t len) {
+  while (len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = len;
+  return op;
+}
+
+inline uint8_t* writeSequence(uint8_t *op, const uint8_t *literals, uint32_t numLiterals, uint32_t offset, uint32_t matchLength) {
+  uint8_t *token = op++;
+  *token = (numLiterals < 15 ? numLiterals : 15) << 4;
+  if (numLiterals >= 15) op = writeLength(op, numLiterals - 15);
+  memcpy(op, literals, numLiterals);
+  op += numLiterals;
+  if (!matchLength) return op;
+  *op++ = offset;
+  *op++ = offset >> 8;
+  matchLength -= MIN_MATCH;
+  *token |= matchLength < 15 ? matchLength : 15;
+  if (matchLength >= 15) op = writeLength(op, matchLength - 15);
+  return op;
+}
+
+inline bool readLength(const uint8_t *&ip, const uint8_t *end, uint32_t &len) {
+  uint8_t b;
+  do {
+    if (ip >= end) return false;
+    b = *ip++;
+    len += b;
+  } while (b == 255);
+  return true;
+}
+
+}
+
+uint32_t lz4Compress(const uint8_t *src, uint32_t size, uint8_t *dst) {
+  // positions are stored plus one, zero means empty
+  uint32_t table[1 << HASH_BITS] = { 0 };
+  uint8_t *op = dst;
+  uint32_t anchor = 0;
+  uint32_t ip = 0;
+  if (size > MATCH_LIMIT) {
+    uint32_t matchEnd = size - LAST_LITERALS;
+    while (ip < size - MATCH_LIMIT) {
+      uint32_t seq = read32(src + ip);
+      uint32_t h = hashSequence(seq);
+      uint32_t ref = table[h];
+      table[h] = ip + 1;
+      if (ref && ip - (ref - 1) <= MAX_OFFSET && read32(src + ref - 1) == seq) {
+        --ref;
+        uint32_t len = MIN_MATCH;
+        while (ip + len < matchEnd && src[ref + len] == src[ip + len]) ++len;
+        op = writeSequence(op, src + anchor, ip - anchor, ip - ref, len);
+        ip += len;
+        anchor = ip;
+      } else {
+        ++ip;
+      }
+    }
+  }
+  op = writeSequence(op, src + anchor, size - anchor, 0, 0);
+  return op - dst;
+}
+
+uint32_t lz4Decompress(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t capacity) {
+  const uint8_t *ip = src;
+  const uint8_t *end = src + size;
+  uint8_t *op = dst;
+  uint8_t *opEnd = dst + capacity;
+  while (ip < end) {
+    uint8_t token = *ip++;
+    uint32_t numLiterals = token >> 4;
+    if (numLiterals == 15 && !readLength(ip, end, numLiterals)) return 0;
+    if (numLiterals > uint32_t(end - ip) || numLiterals > uint32_t(opEnd - op)) return 0;
+    memcpy(op, ip, numLiterals);
+    ip += numLiterals;
+    op += numLiterals;
+    // the last sequence has no match
+    if (ip >= end) break;
+    if (end - ip < 2) return 0;
+    uint32_t offset = ip[0] | ip[1] << 8;
+    ip += 2;
+    uint32_t matchLength = token & 15;
+    if (matchLength == 15 && !readLength(ip, end, matchLength)) return 0;
+    matchLength += MIN_MATCH;
+    if (!offset || offset > uint32_t(op - dst) || matchLength > uint32_t(opEnd - op)) return 0;
+    const uint8_t *match = op - offset;
+    if (offset >= matchLength) {
+      memcpy(op, match, matchLength);
+      op += matchLength;
+    } else {
+      // overlapping, like a run of the same pixel
+      while (matchLength--) *op++ = *match++;
+    }
+  }
+  return op - dst;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+/// Worst case size of lz4Compress output for size bytes of input
+inline uint32_t lz4Bound(uint32_t size) {
+  return size + size / 255 + 16;
+}
+
+/// Compresses size bytes into the LZ4 block format (no frame header),
+/// dst must have room for lz4Bound(size) bytes. Returns the compressed size.
+uint32_t lz4Compress(const uint8_t *src, uint32_t size, uint8_t *dst);
+
+/// Decompresses an LZ4 block into at most capacity bytes. Returns the
+/// number of bytes written, or 0 if the block is malformed or does not fit.
+uint32_t lz4Decompress(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t capacity);
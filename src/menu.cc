@@ -12,6 +12,7 @@ namespace {
       quit,
       mainMenu,
       difficulty,
+      profiler,
     };
   }
 
@@ -27,6 +28,7 @@ namespace {
   const MenuItem mainItems[] = {
     M("Resume", Flags::resume),
     M("Difficulty: %d", Flags::difficulty),
+    M("Profiler: %s", Flags::profiler),
     M("Credits", Flags::credits),
     M("Quit", Flags::quit),
     EOM,
@@ -101,6 +103,10 @@ void Submenu::render(PerfTextOverlay &overlay, GameSettings &settings) {
       char str[256];
       snprintf(str, sizeof(str), s, settings.getDifficulty());
       overlay.write(col, row + i, str);
+    } else if (items[i].flags == Flags::profiler) {
+      char str[256];
+      snprintf(str, sizeof(str), s, settings.getProfiling() ? "on" : "off");
+      overlay.write(col, row + i, str);
     } else {
       if (*s) overlay.write(col, row + i, s);
     }
@@ -144,6 +150,9 @@ Command Menu::execute() {
     case Flags::mainMenu:
       current = main;
       break;
+    case Flags::profiler:
+      settings.setProfiling(!settings.getProfiling());
+      break;
     case Flags::resume:
       return Command::resume;
     case Flags::quit:
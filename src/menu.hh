@@ -10,6 +10,8 @@ class GameSettings {
 public:
   virtual int getDifficulty()=0;
   virtual void setDifficulty(int val)=0;
+  virtual bool getProfiling()=0;
+  virtual void setProfiling(bool val)=0;
 };
 
 class Menu {
@@ -0,0 +1,58 @@
+#include "mix.hh"
+
+#if !defined(MIX_SCALAR) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define MIX_NEON
+#include <arm_neon.h>
+#elif !defined(MIX_SCALAR) && defined(__SSE2__)
+#define MIX_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+inline int32_t clampS16(int32_t v) {
+  if (v > 32767) return 32767;
+  if (v < -32768) return -32768;
+  return v;
+}
+
+inline uint32_t addSaturate(uint32_t a, uint32_t b) {
+  int32_t l = clampS16(static_cast<int16_t>(a) + static_cast<int16_t>(b));
+  int32_t r = clampS16(static_cast<int16_t>(a >> 16) + static_cast<int16_t>(b >> 16));
+  return static_cast<uint32_t>(r) << 16 | (l & 0xffff);
+}
+
+}
+
+void mixSaturate(uint32_t *dst, const uint32_t *src, uint32_t count) {
+#if defined(MIX_NEON)
+  // 8 stereo samples (16 channel values) per iteration
+  for (; count >= 8; count -= 8) {
+    int16_t *d = reinterpret_cast<int16_t*>(dst);
+    const int16_t *s = reinterpret_cast<const int16_t*>(src);
+    int16x8_t d0 = vld1q_s16(d);
+    int16x8_t d1 = vld1q_s16(d + 8);
+    d0 = vqaddq_s16(d0, vld1q_s16(s));
+    d1 = vqaddq_s16(d1, vld1q_s16(s + 8));
+    vst1q_s16(d, d0);
+    vst1q_s16(d + 8, d1);
+    dst += 8;
+    src += 8;
+  }
+#elif defined(MIX_SSE2)
+  for (; count >= 8; count -= 8) {
+    __m128i *d = reinterpret_cast<__m128i*>(dst);
+    const __m128i *s = reinterpret_cast<const __m128i*>(src);
+    __m128i d0 = _mm_adds_epi16(_mm_loadu_si128(d), _mm_loadu_si128(s));
+    __m128i d1 = _mm_adds_epi16(_mm_loadu_si128(d + 1), _mm_loadu_si128(s + 1));
+    _mm_storeu_si128(d, d0);
+    _mm_storeu_si128(d + 1, d1);
+    dst += 8;
+    src += 8;
+  }
+#endif
+  while (count--) {
+    *dst = addSaturate(*dst, *src++);
+    ++dst;
+  }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+
+/// Adds count stereo samples (two signed 16 bit values packed
+/// into each 32 bit word) from src to dst, saturating each
+/// channel to the signed 16 bit range.
+///
+/// Uses NEON or SSE2 where available, define MIX_SCALAR to
+/// force the portable version.
+void mixSaturate(uint32_t *dst, const uint32_t *src, uint32_t count);
@@ -28,6 +28,7 @@
 
 #if defined(MIYOO_AUDIO)
 #include "miyoo_audio.hh"
+#include "trace.hh"
 
 #include <stdio.h>
 #include <string.h>
@@ -168,8 +169,10 @@ static pthread_t audioThread;
 static void* audioThreadFunc(void *ptr) {
   SDL_AudioSpec &spec(dev.getSpec());
   if (!spec.callback) return nullptr;
+  trace::setThreadName("audio");
   while (true) {
     spec.callback(spec.userdata, dev.getBuf(), dev.getBufSize());
+    trace::Scope scope("play");
     dev.play();
   }
   return nullptr;
@@ -1,29 +1,120 @@
 #include "pack.hh"
 #include "image.hh"
+#include <iostream>
+#include <fstream>
+#ifndef __EMSCRIPTEN__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if !defined(PACK_SCALAR) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define PACK_NEON
+#include <arm_neon.h>
+#elif !defined(PACK_SCALAR) && defined(__SSE2__)
+#define PACK_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+#if defined(PACK_NEON)
+
+// KeyHasher::hash on 4 words at once
+inline int32x4_t hash4(int32x4_t val, const KeyHasher &hasher) {
+  int32x4_t hash = vmulq_s32(val, vdupq_n_s32(hasher.m));
+  hash = vaddq_s32(hash, vshlq_s32(vmulq_s32(val, vdupq_n_s32(hasher.n)), vdupq_n_s32(-(hasher.s / 2))));
+  return veorq_s32(hash, vshlq_s32(vmulq_s32(val, vdupq_n_s32(hasher.o)), vdupq_n_s32(-hasher.s)));
+}
+
+#elif defined(PACK_SSE2)
+
+// SSE2 has no 32 bit multiply keeping the low half, build it from the 64 bit one
+inline __m128i mullo32(__m128i a, __m128i b) {
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// KeyHasher::hash on 4 words at once
+inline __m128i hash4(__m128i val, const KeyHasher &hasher) {
+  __m128i hash = mullo32(val, _mm_set1_epi32(hasher.m));
+  hash = _mm_add_epi32(hash, _mm_sra_epi32(mullo32(val, _mm_set1_epi32(hasher.n)), _mm_cvtsi32_si128(hasher.s / 2)));
+  return _mm_xor_si128(hash, _mm_sra_epi32(mullo32(val, _mm_set1_epi32(hasher.o)), _mm_cvtsi32_si128(hasher.s)));
+}
+
+#endif
+
+// decodes whole groups of 4 words, returns the number of words done
+inline uint32_t deobfuscateLanes(uint32_t *p, uint32_t numWords, uint32_t *h, const KeyHasher &hasher) {
+  uint32_t done = numWords & ~3U;
+#if defined(PACK_NEON)
+  int32x4_t key = vreinterpretq_s32_u32(vld1q_u32(h));
+  for (uint32_t j = 0; j < done; j += 4) {
+    int32x4_t plain = veorq_s32(vreinterpretq_s32_u32(vld1q_u32(p + j)), key);
+    vst1q_u32(p + j, vreinterpretq_u32_s32(plain));
+    key = vaddq_s32(key, hash4(plain, hasher));
+  }
+  vst1q_u32(h, vreinterpretq_u32_s32(key));
+#elif defined(PACK_SSE2)
+  __m128i key = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h));
+  for (uint32_t j = 0; j < done; j += 4) {
+    __m128i *w = reinterpret_cast<__m128i*>(p + j);
+    __m128i plain = _mm_xor_si128(_mm_loadu_si128(w), key);
+    _mm_storeu_si128(w, plain);
+    key = _mm_add_epi32(key, hash4(plain, hasher));
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(h), key);
+#else
+  for (uint32_t j = 0; j < done; ++j) {
+    p[j] ^= h[j & 3];
+    h[j & 3] += hasher.hash(p[j]);
+  }
+#endif
+  return done;
+}
+
+}
+
+void obfuscateWords(uint32_t *p, uint32_t numWords, uint32_t key, const KeyHasher &hasher, bool lanes) {
+  uint32_t h[4] = { key, key + 1, key + 2, key + 3 };
+  uint32_t laneMask = lanes ? 3 : 0;
+  for (uint32_t j = 0; j < numWords; ++j) {
+    uint32_t plain = p[j];
+    p[j] ^= h[j & laneMask];
+    h[j & laneMask] += hasher.hash(plain);
+  }
+}
+
+void deobfuscateWords(uint32_t *p, uint32_t numWords, uint32_t key, const KeyHasher &hasher, bool lanes) {
+  uint32_t h[4] = { key, key + 1, key + 2, key + 3 };
+  uint32_t laneMask = 0;
+  uint32_t j = 0;
+  if (lanes) {
+    laneMask = 3;
+    j = deobfuscateLanes(p, numWords, h, hasher);
+  }
+  for (; j < numWords; ++j) {
+    p[j] ^= h[j & laneMask];
+    h[j & laneMask] += hasher.hash(p[j]);
+  }
+}
 
 BufferView SlicedBuffer::lookup(const char *fn) {
   uint32_t *t = table();
   BufferSlice *s = slices();
-  if (flags&1) {
-    for (int i = 0; i < numTableEntries; ++i) {
-      if (~t[i*2]) {
-        uint32_t h = t[i*2];
-        BufferSlice *slice = s + t[i*2+1];
-        uint32_t *p = reinterpret_cast<uint32_t*>(slice->ptr());
-        uint32_t size = (slice->sizeInBytes + 3) >> 2;
-        for (int j = 0; j < size; ++j) {
-          p[j] ^= h;
-          h += hasher.hash(p[j]);
-        }
-      }
-    }
-    flags &= ~1U;
-  }
   uint32_t hash = hasher.hash(fn);
   uint32_t index = (hash % numTableEntries) * 2;
-  uint32_t sliceIndex = t[index + 1];
+  uint32_t sliceIndex = t[index + 1] & ~SLICE_DECODED;
   if (t[index] == hash && sliceIndex < numSlices) {
     s += sliceIndex;
+    if ((flags & FLAG_OBFUSCATED) && !(t[index + 1] & SLICE_DECODED)) {
+      // only the slice asked for, the rest of the pack stays untouched
+      uint32_t *p = reinterpret_cast<uint32_t*>(s->ptr());
+      deobfuscateWords(p, (s->sizeInBytes + 3) >> 2, hash, hasher, flags & FLAG_LANES);
+      t[index + 1] |= SLICE_DECODED;
+    }
     BufferView view { .buffer = s->ptr(), .sizeInBytes = s->sizeInBytes };
     return view;
   } else {
@@ -32,7 +123,60 @@ BufferView SlicedBuffer::lookup(const char *fn) {
   }
 }
 
-SDL_Surface* SlicedBuffer::loadPNG(const char *fn) {
+SDL_Surface* SlicedBuffer::loadPNG(const char *fn, bool convert) {
   BufferView view = lookup(fn);
-  return loadPNGFromMemory(view.buffer, view.sizeInBytes);
+  if (view.sizeInBytes >= sizeof(PixelPayload) &&
+      reinterpret_cast<PixelPayload*>(view.buffer)->magic == PixelPayload::MAGIC) {
+    return loadPixelPayload(view.buffer, view.sizeInBytes, convert);
+  }
+  return loadPNGFromMemory(view.buffer, view.sizeInBytes, convert);
+}
+
+bool PackFile::open(const char *fn) {
+  close();
+#ifndef __EMSCRIPTEN__
+  int fd = ::open(fn, O_RDONLY);
+  if (fd >= 0) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      // private writable mapping: decoding slices in place only
+      // copies the pages it touches, the file stays as it is
+      void *p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        bytes.buffer = p;
+        bytes.sizeInBytes = st.st_size;
+        mapped = true;
+      }
+    }
+    ::close(fd);
+  }
+#endif
+  if (!bytes.buffer) {
+    std::ifstream file(fn, std::ifstream::binary | std::ifstream::ate);
+    if (file) {
+      uint32_t size = file.tellg();
+      file.seekg(0);
+      bytes.buffer = new char[size];
+      bytes.sizeInBytes = size;
+      file.read(reinterpret_cast<char*>(bytes.buffer), size);
+    }
+  }
+  if (bytes.sizeInBytes < sizeof(SlicedBuffer) || pack()->magic != SlicedBuffer::MAGIC) {
+    std::cerr << "Invalid asset pack: " << fn << std::endl;
+    close();
+    return false;
+  }
+  return true;
+}
+
+void PackFile::close() {
+#ifndef __EMSCRIPTEN__
+  if (mapped) {
+    munmap(bytes.buffer, bytes.sizeInBytes);
+    bytes.buffer = nullptr;
+    bytes.sizeInBytes = 0;
+    mapped = false;
+  }
+#endif
+  bytes.release();
 }
@@ -50,8 +50,20 @@ struct BufferSlice {
   }
 };
 
+/// Slice contents in an obfuscated pack are XORed with a running key
+/// that starts from the file name hash and is advanced by the hash of
+/// every plain word. With lanes the words are split into 4 independent
+/// streams (word j belongs to lane j % 4, which starts from key + lane),
+/// so 4 words can be decoded at a time.
+void obfuscateWords(uint32_t *p, uint32_t numWords, uint32_t key, const KeyHasher &hasher, bool lanes);
+void deobfuscateWords(uint32_t *p, uint32_t numWords, uint32_t key, const KeyHasher &hasher, bool lanes);
+
 struct SlicedBuffer {
   static const uint32_t MAGIC = 0x11897253;
+  static const uint32_t FLAG_OBFUSCATED = 1;
+  static const uint32_t FLAG_LANES = 2;
+  // set on the slice index in the table once the slice is deobfuscated
+  static const uint32_t SLICE_DECODED = 0x80000000U;
 
   uint32_t magic;
   KeyHasher hasher;
@@ -75,5 +87,28 @@ protected:
 
 public:
   BufferView lookup(const char *fn);
-  SDL_Surface* loadPNG(const char *fn);
+  /// Loads a PNG, or a PixelPayload stored under the PNG's name,
+  /// see loadPNGFromMemory for convert
+  SDL_Surface* loadPNG(const char *fn, bool convert = true);
+};
+
+/// Holds the bytes of an asset pack for the life of the program.
+/// The file is mapped privately where mmap is available, so only the
+/// pages that get touched are read and lookup can still decode slices
+/// in place, Emscripten reads the whole file instead.
+class PackFile {
+  BufferView bytes;
+  bool mapped;
+public:
+  inline PackFile(): bytes { .buffer = nullptr, .sizeInBytes = 0 }, mapped(false) { }
+  inline ~PackFile() {
+    close();
+  }
+
+  bool open(const char *fn);
+  void close();
+
+  inline SlicedBuffer* pack() {
+    return reinterpret_cast<SlicedBuffer*>(bytes.buffer);
+  }
 };
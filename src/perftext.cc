@@ -1,8 +1,18 @@
 #include <string.h>
+#include <algorithm>
 
 #include "perftext.hh"
+#include "format.hh"
 #include "util.hh"
 
+#if !defined(PERFTEXT_SCALAR) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define PERFTEXT_NEON
+#include <arm_neon.h>
+#elif !defined(PERFTEXT_SCALAR) && defined(__SSE2__)
+#define PERFTEXT_SSE2
+#include <emmintrin.h>
+#endif
+
 static const unsigned char font8[] = {
   0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7e, 0x81, 0xa5, 0x81,
   0xbd, 0x99, 0x81, 0x7e, 0x7e, 0xff, 0xdb, 0xff, 0xc3, 0xe7, 0xff, 0x7e,
@@ -179,16 +189,91 @@ static const unsigned char font8[] = {
 static const unsigned int font8_len = 2048;
 static const uint64_t *font8_64 = reinterpret_cast<const uint64_t*>(font8);
 
+namespace {
+
+/// Every glyph row byte expanded into 8 pixel masks, bit 0 is the leftmost pixel
+struct GlyphRowMasks {
+  alignas(16) uint32_t masks[256][8];
+
+  GlyphRowMasks() {
+    for (int b = 0; b < 256; ++b) {
+      for (int x = 0; x < 8; ++x) masks[b][x] = (b >> x) & 1 ? UINT32_MAX : 0;
+    }
+  }
+};
+
+const GlyphRowMasks glyphRowMasks;
+
+/// font8 transposed for drawing on its side: a byte for every
+/// column of a glyph, with a bit for every row, top row first
+struct GlyphColumns {
+  uint8_t columns[256][8];
+
+  GlyphColumns() {
+    for (int c = 0; c < 256; ++c) {
+      for (int x = 0; x < 8; ++x) {
+        uint8_t column = 0;
+        for (int y = 0; y < 8; ++y) column |= ((font8[c * 8 + y] >> x) & 1) << y;
+        columns[c][x] = column;
+      }
+    }
+  }
+};
+
+const GlyphColumns glyphColumns;
+
+/// Rasterizes a glyph row: masks are set where the bits of ink or
+/// shade are, values to color for ink and shadowColor for shade
+inline void rasterizeGlyphRow(uint32_t *masks, uint32_t *values, uint32_t ink, uint32_t shade,
+    uint32_t color, uint32_t shadowColor) {
+  const uint32_t *im = glyphRowMasks.masks[ink];
+  const uint32_t *sm = glyphRowMasks.masks[shade];
+  for (int i = 0; i < 8; ++i) {
+    masks[i] = im[i] | sm[i];
+    values[i] = (color & im[i]) | (shadowColor & sm[i]);
+  }
+}
+
+/// Replaces the pixels of dst where masks are set with values
+inline void compositeLine(uint32_t *dst, const uint32_t *masks, const uint32_t *values, int count) {
+  int i = 0;
+#if defined(PERFTEXT_NEON)
+  for (; i + 4 <= count; i += 4) {
+    vst1q_u32(dst + i, vbslq_u32(vld1q_u32(masks + i), vld1q_u32(values + i), vld1q_u32(dst + i)));
+  }
+#elif defined(PERFTEXT_SSE2)
+  for (; i + 4 <= count; i += 4) {
+    __m128i *dp = reinterpret_cast<__m128i*>(dst + i);
+    __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks + i));
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+    _mm_storeu_si128(dp, _mm_or_si128(_mm_andnot_si128(m, _mm_loadu_si128(dp)), v));
+  }
+#endif
+  for (; i < count; ++i) dst[i] = (dst[i] & ~masks[i]) | values[i];
+}
+
+}
+
 
 namespace perf {
 
+namespace {
+
+// the widest a setw can pad a number to
+const int MAX_FIELD_WIDTH = 62;
+
+}
+
 Window::Window(PerfTextOverlay &overlay, int x, int y, int w, int h):
     buffer(overlay.buffer + y * overlay.numColumns + x),
     pitch(overlay.numColumns),
     numColumns(w),
     numRows(h),
     cursor(buffer),
-    width(0) {
+    cursorRow(0),
+    cursorColumn(0),
+    width(0),
+    precision(2) {
 
 }
 
@@ -254,19 +339,18 @@ void Window::writeString(const char *str) {
   }
 }
 
-void Window::align(char *str, int32_t size) {
-  if (width && width < size - 1) {
-    int l = strnlen(str, size);
-    if (width <= l) return;
-    int spacesNeeded = width - l;
+void Window::writeNumber(char *start, char *end) {
+  // a width only applies to a number shorter than it
+  if (width > end - start && width <= MAX_FIELD_WIDTH) {
+    end = alignRight(start, end, width);
     width = 0;
-    if (spacesNeeded + l + 1 > size) {
-      return;
-    }
-    memmove(str + spacesNeeded, str, l + 1);  // include terminating zero
-    for (int i = spacesNeeded; i > 0; --i)
-      *str++ = 32;
-//    memset(str, 32, spacesNeeded);
+  }
+  if (cursorColumn + (end - start) < numColumns) {
+    // fits in the line, straight into the buffer
+    for (char *p = start; p < end; ++p) *cursor++ = *p;
+    cursorColumn += end - start;
+  } else {
+    writeString(start);
   }
 }
 
@@ -286,26 +370,32 @@ Window& Window::operator<<(const char *str) {
 }
 
 Window& Window::operator<<(uint32_t n) {
-  char s[32] = { 0 };
-  snprintf(s, sizeof(s), "%" PRIu32, n);
-  align(s, sizeof(s));
-  writeString(s);
+  char s[MAX_FIELD_WIDTH + 1];
+  writeNumber(s, formatUnsigned(s, n));
   return *this;
 }
 
 Window& Window::operator<<(int32_t n) {
-  char s[32] = { 0 };
-  snprintf(s, sizeof(s), "%" PRId32, n);
-  align(s, sizeof(s));
-  writeString(s);
+  char s[MAX_FIELD_WIDTH + 1];
+  writeNumber(s, formatSigned(s, n));
   return *this;
 }
 
 Window& Window::operator<<(int64_t n) {
-  char s[64] = { 0 };
-  snprintf(s, sizeof(s), "%" PRId64, n);
-  align(s, sizeof(s));
-  writeString(s);
+  char s[MAX_FIELD_WIDTH + 1];
+  writeNumber(s, formatSigned(s, n));
+  return *this;
+}
+
+Window& Window::operator<<(double d) {
+  char s[MAX_FIELD_WIDTH + 1];
+  writeNumber(s, formatFloat(s, d, precision));
+  return *this;
+}
+
+Window& Window::operator<<(const fixed &f) {
+  char s[MAX_FIELD_WIDTH + 1];
+  writeNumber(s, formatFixed(s, f.value, f.decimals));
   return *this;
 }
 
@@ -319,11 +409,16 @@ Window& Window::operator<<(const setw &newWidth) {
   return *this;
 }
 
+Window& Window::operator<<(const setprecision &newPrecision) {
+  precision = newPrecision.p;
+  return *this;
+}
+
 }
 
 PerfTextOverlay::PerfTextOverlay(int pixelWidth, int pixelHeight, int orientation, bool shadow):
-  numColumns((pixelWidth >> 3) & ~3),
-  numRows((pixelHeight - (shadow ? 1 : 0)) >> 3),
+  numColumns(((orientation & 1 ? pixelHeight : pixelWidth) >> 3) & ~3),
+  numRows(((orientation & 1 ? pixelWidth : pixelHeight) - (shadow ? 1 : 0)) >> 3),
   color(UINT32_MAX),
   shadowColor(0),
   shadow(shadow),
@@ -331,6 +426,10 @@ PerfTextOverlay::PerfTextOverlay(int pixelWidth, int pixelHeight, int orientatio
   numChars = numRows * numColumns;
   buffer = new char[numChars];
   memset(buffer, 0, numChars);
+  rasterizedText = new char[numChars];
+  memset(rasterizedText, 0, numChars);
+  rows = new RowRaster[numRows];
+  rastersValid = true;
 }
 
 PerfTextOverlay::~PerfTextOverlay() {
@@ -338,6 +437,8 @@ PerfTextOverlay::~PerfTextOverlay() {
     delete[] buffer;
     buffer = nullptr;
   }
+  delete[] rasterizedText;
+  delete[] rows;
 }
 
 void PerfTextOverlay::write(uint32_t x, uint32_t y, const char *text) {
@@ -350,87 +451,133 @@ void PerfTextOverlay::write(uint32_t x, uint32_t y, const char *text) {
   }
 }
 
-void PerfTextOverlay::drawOverlayNormal(SDL_Surface *surface) {
-  uint32_t* __attribute__((aligned(32))) pixels = reinterpret_cast<uint32_t*>(surface->pixels);
-  int32_t pixelPitch = surface->pitch >> 2;
-  int32_t endToStart = 8 * pixelPitch - 8 * numColumns;
-  const uint32_t* __attribute__((aligned(32))) text4 = reinterpret_cast<const uint32_t*>(buffer);
-  uint32_t col = 0;
-  for (int c = 0; c < numChars; c += 4) {
-    uint32_t fourChars = *text4;
-    for (int cx = 0; cx < 4; ++cx) {
-      // a character is 8 bytes, that's one 64 bit word
-      uint64_t f = font8_64[fourChars & 0xff];
-      fourChars >>= 8;
-      if (f) {
-        uint32_t *line = pixels;
-        for (int y = 0; y < 8; ++y) {
-          for (int x = 0; x < 8; ++x) {
-            if (f&1) {
-              *line = color;
-              if (shadow) line[pixelPitch] = shadowColor;
-            }
-            f >>= 1;
-            ++line;
-          }
-          line += pixelPitch - 8;
+void PerfTextOverlay::rasterizeRow(int row) {
+  RowRaster &raster = rows[row];
+  raster.segments.clear();
+  raster.masks.clear();
+  raster.values.clear();
+  const char *text = buffer + row * numColumns;
+  int h = shadow ? 9 : 8;
+  // the text area, shadow included
+  int textWidth = numColumns * 8;
+  int textHeight = numRows * 8 + (shadow ? 1 : 0);
+  int first = 0;
+  while (first < numColumns) {
+    if (!text[first]) {
+      ++first;
+      continue;
+    }
+    int end = first + 1;
+    while (end < numColumns && text[end]) ++end;
+    int left = first * 8;
+    int top = row * 8;
+    int w = (end - first) * 8;
+    TextSegment segment;
+    segment.offset = raster.masks.size();
+    raster.masks.resize(segment.offset + w * h);
+    raster.values.resize(segment.offset + w * h);
+    uint32_t *masks = raster.masks.data() + segment.offset;
+    uint32_t *values = raster.values.data() + segment.offset;
+    if (orientation & 1) {
+      // on its side the top of the text faces left: a line of the
+      // surface is a column of the text, the rightmost one first
+      segment = TextSegment { .x = top, .y = textWidth - left - w, .w = h, .h = w, .offset = segment.offset };
+      for (int line = 0; line < w; ++line) {
+        int column = w - 1 - line;
+        uint32_t ink = glyphColumns.columns[static_cast<uint8_t>(text[first + (column >> 3)])][column & 7];
+        // the shadow is one pixel down the column, under its own ink
+        uint32_t shade = shadow ? (ink << 1) & ~ink : 0;
+        rasterizeGlyphRow(masks, values, ink, shade & 0xff, color, shadowColor);
+        if (shadow) {
+          masks[8] = shade & 0x100 ? UINT32_MAX : 0;
+          values[8] = shade & 0x100 ? shadowColor : 0;
+        }
+        masks += h;
+        values += h;
+      }
+    } else {
+      segment = TextSegment { .x = left, .y = top, .w = w, .h = h, .offset = segment.offset };
+      for (int c = first; c < end; ++c) {
+        // a character is 8 bytes, that's one 64 bit word
+        uint64_t f = font8_64[static_cast<uint8_t>(text[c])];
+        // the shadow of a row lands on the next one, under its own ink,
+        // and the shadow of the last row one line below the glyph
+        uint32_t above = 0;
+        for (int y = 0; y < h; ++y) {
+          uint32_t ink = f & 0xff;
+          f >>= 8;
+          uint32_t shade = shadow ? above & ~ink : 0;
+          uint32_t offset = y * w + (c - first) * 8;
+          rasterizeGlyphRow(masks + offset, values + offset, ink, shade, color, shadowColor);
+          above = ink;
         }
       }
-      pixels += 8;
     }
-    ++text4;
-    col += 4;
-    if (col >= numColumns) {
-      pixels += endToStart;
-      col -= numColumns;
+    if (orientation & 2) {
+      // turning it around is the same pixels in reverse order
+      masks = raster.masks.data() + segment.offset;
+      values = raster.values.data() + segment.offset;
+      std::reverse(masks, masks + w * h);
+      std::reverse(values, values + w * h);
+      if (orientation & 1) {
+        segment.x = textHeight - segment.x - segment.w;
+        segment.y = textWidth - segment.y - segment.h;
+      } else {
+        segment.x = textWidth - segment.x - segment.w;
+        segment.y = textHeight - segment.y - segment.h;
+      }
     }
+    raster.segments.push_back(segment);
+    first = end;
+  }
+}
+
+void PerfTextOverlay::updateRasters() {
+  for (int row = 0; row < numRows; ++row) {
+    char *text = buffer + row * numColumns;
+    char *rasterized = rasterizedText + row * numColumns;
+    if (rastersValid && memcmp(text, rasterized, numColumns) == 0) continue;
+    memcpy(rasterized, text, numColumns);
+    rasterizeRow(row);
   }
+  rastersValid = true;
 }
 
-void PerfTextOverlay::drawOverlay180(SDL_Surface *surface) {
-  uint32_t* __attribute__((aligned(32))) pixels = reinterpret_cast<uint32_t*>(surface->pixels);
+void PerfTextOverlay::drawOverlay(SDL_Surface *surface) {
+  updateRasters();
+  uint32_t *pixels = reinterpret_cast<uint32_t*>(surface->pixels);
   int32_t pixelPitch = surface->pitch >> 2;
-  int32_t endToStart = 8 * pixelPitch - 8 * numColumns;
-  const uint32_t* __attribute__((aligned(32))) text4 = reinterpret_cast<const uint32_t*>(buffer);
-  uint32_t charsWrittenInRow = 0;
-
-  pixels += pixelPitch * (numRows * 8 - 1) + numColumns * 8 - 1;
-
-  for (int c = 0; c < numChars; c += 4) {
-    uint32_t fourChars = *text4;
-    for (int cx = 0; cx < 4; ++cx) {
-      // a character is 8 bytes, that's one 64 bit word
-      uint64_t f = font8_64[fourChars & 0xff];
-      fourChars >>= 8;
-      if (f) {
-        uint32_t *line = pixels;
-        for (int y = 0; y < 8; ++y) {
-          for (int x = 0; x < 8; ++x) {
-            if (f&1) {
-              *line = color;
-              if (shadow) line[-pixelPitch] = shadowColor;
-            }
-            f >>= 1;
-            --line;
-          }
-          line -= pixelPitch - 8;
-        }
+  // in row order, so ink wins over the shadow of the row before
+  for (int row = 0; row < numRows; ++row) {
+    const RowRaster &raster = rows[row];
+    for (const TextSegment &segment: raster.segments) {
+      uint32_t *line = pixels + segment.y * pixelPitch + segment.x;
+      const uint32_t *masks = raster.masks.data() + segment.offset;
+      const uint32_t *values = raster.values.data() + segment.offset;
+      for (int y = 0; y < segment.h; ++y) {
+        compositeLine(line, masks, values, segment.w);
+        line += pixelPitch;
+        masks += segment.w;
+        values += segment.w;
       }
-      pixels -= 8;
-    }
-    ++text4;
-    charsWrittenInRow += 4;
-    if (charsWrittenInRow >= numColumns) {
-      pixels -= endToStart;
-      charsWrittenInRow -= numColumns;
     }
   }
 }
 
-void PerfTextOverlay::drawOverlay(SDL_Surface *surface) {
-  if (orientation & 2) {
-    drawOverlay180(surface);
-  } else {
-    drawOverlayNormal(surface);
+int PerfTextOverlay::getDirtyRects(SDL_Rect *rects, int maxRects) {
+  updateRasters();
+  int n = 0;
+  for (int row = 0; row < numRows; ++row) {
+    for (const TextSegment &segment: rows[row].segments) {
+      if (n < maxRects) {
+        SDL_Rect &r = rects[n];
+        r.x = segment.x;
+        r.y = segment.y;
+        r.w = segment.w;
+        r.h = segment.h;
+      }
+      ++n;
+    }
   }
+  return n;
 }
@@ -4,12 +4,33 @@
 #include <memory>
 #include <string.h>
 #include <stdint.h>
+#include <vector>
 
 namespace perf { class Window; }
 
 class PerfTextOverlay {
   friend class perf::Window;
+
+  /// A run of cells with text in a row, rasterized
+  struct TextSegment {
+    // where it goes on the surface
+    int x, y, w, h;
+    // of its first pixel in the masks and values of the row
+    uint32_t offset;
+  };
+
+  /// The rasterized text of a row: for every pixel of every segment,
+  /// which pixels of the surface to replace and what with
+  struct RowRaster {
+    std::vector<TextSegment> segments;
+    std::vector<uint32_t> masks;
+    std::vector<uint32_t> values;
+  };
+
   char* __attribute__((aligned(32))) buffer;
+  // the text the rows were rasterized from
+  char *rasterizedText;
+  RowRaster *rows;
   // numColumns is always divisible by 4
   int numColumns;
   int numChars;
@@ -18,18 +39,27 @@ class PerfTextOverlay {
   uint32_t shadowColor;
   int orientation;
   bool shadow;
+  // false when every row has to be rasterized again
+  bool rastersValid;
 
-  void drawOverlayNormal(SDL_Surface *surface);
-  void drawOverlay180(SDL_Surface *surface);
+  void rasterizeRow(int row);
+  /// Rasterizes the rows with text that changed since the last call
+  void updateRasters();
 public:
+  /// The size is that of the surface drawn on. Orientation is in
+  /// quarter turns: 0 is normal, 2 upside down, 1 is on its side
+  /// with the top of the text facing left (like the frames
+  /// presented on a vertical screen), and 3 with it facing right.
   PerfTextOverlay(int pixelWidth, int pixelHeight, int orientation, bool shadow);
   ~PerfTextOverlay();
 
   inline void setColor(uint32_t newColor) {
+    if (color != newColor) rastersValid = false;
     color = newColor;
   }
 
   inline void setShadowColor(uint32_t newColor) {
+    if (shadowColor != newColor) rastersValid = false;
     shadowColor = newColor;
   }
 
@@ -55,8 +85,15 @@ public:
   /// The surface is assumed to be locked,
   /// and to be at least the size that was given
   /// in the constructor (it can be larger though).
-  /// The pixel format should be 32 bits
+  /// The pixel format should be 32 bits.
+  /// Rows are rasterized only when their text changes,
+  /// and only the rows with text are drawn.
   void drawOverlay(SDL_Surface *surface);
+
+  /// Fills rects with the areas drawOverlay draws on, one per run of
+  /// text, shadow included. Returns the number of rects, which can be
+  /// more than maxRects (only that many are filled).
+  int getDirtyRects(SDL_Rect *rects, int maxRects);
 };
 
 namespace perf {
@@ -69,6 +106,22 @@ namespace perf {
     inline setw(int val) : w(val) {}
   };
 
+  /// Decimals for the floating point numbers that follow
+  struct setprecision {
+    const int p;
+
+    inline setprecision(int val) : p(val) {}
+  };
+
+  /// A fixed point number: value / 10^decimals, like
+  /// microseconds shown as milliseconds with 3 decimals
+  struct fixed {
+    const int64_t value;
+    const int decimals;
+
+    inline fixed(int64_t value, int decimals) : value(value), decimals(decimals) {}
+  };
+
   class Window {
     char *buffer, *cursor;
     int cursorRow, cursorColumn;
@@ -76,11 +129,12 @@ namespace perf {
     int pitch;
     int numRows;
     int width;
+    int precision;
 
     void scrollUp(int amount);
     void finishLine(bool force);
     void writeString(const char *str);
-    void align(char *str, int32_t size);
+    void writeNumber(char *start, char *end);
   public:
     Window(PerfTextOverlay &overlay, int x, int y, int w, int h);
 
@@ -89,8 +143,11 @@ namespace perf {
     Window& operator<<(uint32_t n);
     Window& operator<<(int32_t n);
     Window& operator<<(int64_t n);
+    Window& operator<<(double d);
+    Window& operator<<(const fixed &f);
     Window& operator<<(bool b);
     Window& operator<<(const setw &newWidth);
+    Window& operator<<(const setprecision &newPrecision);
   };
 
 }
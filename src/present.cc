@@ -0,0 +1,272 @@
+#include "present.hh"
+#include "jobs.hh"
+#include <string.h>
+
+#if !defined(PRESENT_SCALAR) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define PRESENT_NEON
+#include <arm_neon.h>
+#elif !defined(PRESENT_SCALAR) && defined(__SSE2__)
+#define PRESENT_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const uint32_t OPAQUE = 0xFF000000u;
+
+// widens count pixels 2x, src is read forwards or, when flipped,
+// backwards from src[count - 1] with the alpha channel set
+template<bool flipped> void widen2(uint32_t *dst, const uint32_t *src, int count) {
+  int x = 0;
+#if defined(PRESENT_NEON)
+  uint32x4_t alpha = vdupq_n_u32(flipped ? OPAQUE : 0);
+  for (; x + 4 <= count; x += 4) {
+    uint32x4_t v;
+    if (flipped) {
+      v = vrev64q_u32(vld1q_u32(src + count - x - 4));
+      v = vorrq_u32(vcombine_u32(vget_high_u32(v), vget_low_u32(v)), alpha);
+    } else {
+      v = vld1q_u32(src + x);
+    }
+    uint32x4x2_t pair = { { v, v } };
+    vst2q_u32(dst + x * 2, pair);
+  }
+#elif defined(PRESENT_SSE2)
+  __m128i alpha = _mm_set1_epi32(flipped ? OPAQUE : 0);
+  for (; x + 4 <= count; x += 4) {
+    __m128i v;
+    if (flipped) {
+      v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + count - x - 4));
+      v = _mm_or_si128(_mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)), alpha);
+    } else {
+      v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+    }
+    __m128i *d = reinterpret_cast<__m128i*>(dst + x * 2);
+    _mm_storeu_si128(d, _mm_unpacklo_epi32(v, v));
+    _mm_storeu_si128(d + 1, _mm_unpackhi_epi32(v, v));
+  }
+#endif
+  for (; x < count; ++x) {
+    uint32_t p = flipped ? src[count - x - 1] | OPAQUE : src[x];
+    dst[x * 2] = p;
+    dst[x * 2 + 1] = p;
+  }
+}
+
+template<bool flipped> void widen4(uint32_t *dst, const uint32_t *src, int count) {
+  int x = 0;
+#if defined(PRESENT_NEON)
+  uint32x4_t alpha = vdupq_n_u32(flipped ? OPAQUE : 0);
+  for (; x + 4 <= count; x += 4) {
+    uint32x4_t v;
+    if (flipped) {
+      v = vrev64q_u32(vld1q_u32(src + count - x - 4));
+      v = vorrq_u32(vcombine_u32(vget_high_u32(v), vget_low_u32(v)), alpha);
+    } else {
+      v = vld1q_u32(src + x);
+    }
+    uint32x4x4_t quad = { { v, v, v, v } };
+    vst4q_u32(dst + x * 4, quad);
+  }
+#elif defined(PRESENT_SSE2)
+  __m128i alpha = _mm_set1_epi32(flipped ? OPAQUE : 0);
+  for (; x + 4 <= count; x += 4) {
+    __m128i v;
+    if (flipped) {
+      v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + count - x - 4));
+      v = _mm_or_si128(_mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)), alpha);
+    } else {
+      v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+    }
+    __m128i lo = _mm_unpacklo_epi32(v, v);
+    __m128i hi = _mm_unpackhi_epi32(v, v);
+    __m128i *d = reinterpret_cast<__m128i*>(dst + x * 4);
+    _mm_storeu_si128(d, _mm_unpacklo_epi32(lo, lo));
+    _mm_storeu_si128(d + 1, _mm_unpackhi_epi32(lo, lo));
+    _mm_storeu_si128(d + 2, _mm_unpacklo_epi32(hi, hi));
+    _mm_storeu_si128(d + 3, _mm_unpackhi_epi32(hi, hi));
+  }
+#endif
+  for (; x < count; ++x) {
+    uint32_t p = flipped ? src[count - x - 1] | OPAQUE : src[x];
+    uint32_t *d = dst + x * 4;
+    d[0] = d[1] = d[2] = d[3] = p;
+  }
+}
+
+template<bool flipped> void widen(uint32_t *dst, const uint32_t *src, int count, int shift) {
+  if (shift == 2) {
+    widen4<flipped>(dst, src, count);
+  } else if (shift == 1) {
+    widen2<flipped>(dst, src, count);
+  } else {
+    // generic fallback, also covers no scaling at all
+    for (int x = 0; x < count << shift; ++x) {
+      dst[x] = flipped ? src[count - (x >> shift) - 1] | OPAQUE : src[x >> shift];
+    }
+  }
+}
+
+// copies the first row of a (1 << shift) row block into the others
+inline void replicateRow(uint32_t *dst, int32_t dstPitch, int count, int shift) {
+  for (int i = 1; i < 1 << shift; ++i) {
+    memcpy(dst + i * dstPitch, dst, count * sizeof(uint32_t));
+  }
+}
+
+template<bool flipped> void upscaleRows(uint32_t *dst, int32_t dstPitch, const uint32_t *src, int32_t srcPitch, int w, int h, int shift) {
+  if (flipped) src += (h - 1) * srcPitch;
+  for (int y = 0; y < h; ++y) {
+    widen<flipped>(dst, src, w, shift);
+    replicateRow(dst, dstPitch, w << shift, shift);
+    dst += dstPitch << shift;
+    src += flipped ? -srcPitch : srcPitch;
+  }
+}
+
+// source columns per strip, 64 bytes, so every source cache line
+// is used up by one strip
+const int STRIP = 16;
+// source rows per pass, bounds the scratch buffer to 16 KB
+const int CHUNK = 256;
+
+// rotates a strip of count source columns by 90 degrees into scratch
+// rows and sets the alpha channel: scratch row k gets source
+// column count - 1 - k, top to bottom
+void rotateStrip(uint32_t *scratch, int32_t scratchPitch, const uint32_t *src, int32_t srcPitch, int count, int rows) {
+  int y = 0;
+#if defined(PRESENT_NEON)
+  if (count == STRIP) {
+    uint32x4_t alpha = vdupq_n_u32(OPAQUE);
+    for (; y + 4 <= rows; y += 4) {
+      const uint32_t *s = src + y * srcPitch;
+      for (int x = 0; x < STRIP; x += 4) {
+        uint32x4x2_t t01 = vtrnq_u32(vld1q_u32(s + x), vld1q_u32(s + srcPitch + x));
+        uint32x4x2_t t23 = vtrnq_u32(vld1q_u32(s + srcPitch * 2 + x), vld1q_u32(s + srcPitch * 3 + x));
+        uint32_t *d = scratch + (STRIP - 1 - x) * scratchPitch + y;
+        vst1q_u32(d, vorrq_u32(vcombine_u32(vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0])), alpha));
+        vst1q_u32(d - scratchPitch, vorrq_u32(vcombine_u32(vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1])), alpha));
+        vst1q_u32(d - scratchPitch * 2, vorrq_u32(vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0])), alpha));
+        vst1q_u32(d - scratchPitch * 3, vorrq_u32(vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1])), alpha));
+      }
+    }
+  }
+#elif defined(PRESENT_SSE2)
+  if (count == STRIP) {
+    __m128i alpha = _mm_set1_epi32(OPAQUE);
+    for (; y + 4 <= rows; y += 4) {
+      const uint32_t *s = src + y * srcPitch;
+      for (int x = 0; x < STRIP; x += 4) {
+        __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + x));
+        __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + srcPitch + x));
+        __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + srcPitch * 2 + x));
+        __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + srcPitch * 3 + x));
+        __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+        __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+        __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+        __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+        uint32_t *d = scratch + (STRIP - 1 - x) * scratchPitch + y;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(d), _mm_or_si128(_mm_unpacklo_epi64(t0, t1), alpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(d - scratchPitch), _mm_or_si128(_mm_unpackhi_epi64(t0, t1), alpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(d - scratchPitch * 2), _mm_or_si128(_mm_unpacklo_epi64(t2, t3), alpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(d - scratchPitch * 3), _mm_or_si128(_mm_unpackhi_epi64(t2, t3), alpha));
+      }
+    }
+  }
+#endif
+  for (; y < rows; ++y) {
+    const uint32_t *s = src + y * srcPitch;
+    for (int x = 0; x < count; ++x) {
+      scratch[(count - 1 - x) * scratchPitch + y] = s[x] | OPAQUE;
+    }
+  }
+}
+
+}
+
+void upscale(uint32_t *dst, int32_t dstPitch, const uint32_t *src, int32_t srcPitch, int w, int h, int shift) {
+  upscaleRows<false>(dst, dstPitch, src, srcPitch, w, h, shift);
+}
+
+void upscaleFlipped(uint32_t *dst, int32_t dstPitch, const uint32_t *src, int32_t srcPitch, int w, int h, int shift) {
+  upscaleRows<true>(dst, dstPitch, src, srcPitch, w, h, shift);
+}
+
+void rotateUpscale(uint32_t *dst, int32_t dstPitch, const uint32_t *src, int32_t srcPitch, int w, int h, int shift) {
+  uint32_t scratch[STRIP * CHUNK];
+  for (int strip = 0; strip < w; strip += STRIP) {
+    // target row blocks strip onwards come from the source columns
+    // right to left, starting at the last one
+    int count = w - strip < STRIP ? w - strip : STRIP;
+    const uint32_t *columns = src + w - strip - count;
+    for (int y = 0; y < h; y += CHUNK) {
+      int rows = h - y < CHUNK ? h - y : CHUNK;
+      rotateStrip(scratch, rows, columns + y * srcPitch, srcPitch, count, rows);
+      for (int k = 0; k < count; ++k) {
+        uint32_t *d = dst + ((strip + k) << shift) * dstPitch + (y << shift);
+        widen<false>(d, scratch + k * rows, rows, shift);
+        replicateRow(d, dstPitch, rows << shift, shift);
+      }
+    }
+  }
+}
+
+namespace {
+
+struct PresentParams {
+  PresentLayout layout;
+  uint32_t *dst;
+  int32_t dstPitch;
+  const uint32_t *src;
+  int32_t srcPitch;
+  int w, h, shift;
+  int numBands;
+  // source rows (or columns when rotated) per band
+  int bandSize;
+
+  void runBand(int band) const {
+    int count = layout == PresentLayout::rotated ? w : h;
+    int first = band * bandSize;
+    int last = first + bandSize < count ? first + bandSize : count;
+    if (first >= last) return;
+    switch (layout) {
+    case PresentLayout::normal:
+      upscale(dst + (first << shift) * dstPitch, dstPitch, src + first * srcPitch, srcPitch, w, last - first, shift);
+      break;
+    case PresentLayout::flipped:
+      // the last source rows end up at the top
+      upscaleFlipped(dst + ((h - last) << shift) * dstPitch, dstPitch, src + first * srcPitch, srcPitch, w, last - first, shift);
+      break;
+    case PresentLayout::rotated:
+      // target rows come from the source columns right to left
+      rotateUpscale(dst + (first << shift) * dstPitch, dstPitch, src + w - last, srcPitch, last - first, h, shift);
+      break;
+    }
+  }
+};
+
+}
+
+void present(PresentLayout layout, uint32_t *dst, int32_t dstPitch, const uint32_t *src, int32_t srcPitch,
+    int w, int h, int shift, JobPool &pool, int numBands) {
+  int count = layout == PresentLayout::rotated ? w : h;
+  if (numBands < 1) numBands = 1;
+  int bandSize = (count + numBands - 1) / numBands;
+  if (layout == PresentLayout::rotated) {
+    // keep whole strips in each band
+    bandSize = (bandSize + STRIP - 1) / STRIP * STRIP;
+  }
+  PresentParams params { layout, dst, dstPitch, src, srcPitch, w, h, shift, numBands, bandSize };
+  if (numBands == 1) {
+    params.runBand(0);
+    return;
+  }
+  for (int band = 1; band < numBands; ++band) {
+    const PresentParams *p = &params;
+    pool.add([p, band] {
+      p->runBand(band);
+    });
+  }
+  params.runBand(0);
+  pool.wait();
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+class JobPool;
+
+enum class PresentLayout {
+  normal,
+  flipped,
+  rotated,
+};
+
+/// Writes w x h pixels of src into dst scaled up by 1 << shift (2x or 4x)
+/// in both directions. Pitches are in pixels. Each source row is widened
+/// into the first of its target rows once, the others are plain copies.
+void upscale(uint32_t *dst, int32_t dstPitch, const uint32_t *src, int32_t srcPitch, int w, int h, int shift);
+
+/// Like upscale, but rotated by 180 degrees and with the alpha
+/// channel forced to opaque, for screens mounted upside down
+void upscaleFlipped(uint32_t *dst, int32_t dstPitch, const uint32_t *src, int32_t srcPitch, int w, int h, int shift);
+
+/// Writes w x h pixels of src into dst rotated by 90 degrees counter
+/// clockwise, scaled up by 1 << shift and with the alpha channel forced
+/// to opaque, for portrait screens. dst is h << shift pixels wide. The
+/// rotation goes through a small scratch buffer a 16 column strip at a
+/// time, so the target is written row by row.
+void rotateUpscale(uint32_t *dst, int32_t dstPitch, const uint32_t *src, int32_t srcPitch, int w, int h, int shift);
+
+/// Runs the kernel for layout split into numBands horizontal bands of
+/// the target, all but one of them on pool, and returns once every
+/// band is done. With one band it just calls the kernel.
+void present(PresentLayout layout, uint32_t *dst, int32_t dstPitch, const uint32_t *src, int32_t srcPitch,
+    int w, int h, int shift, JobPool &pool, int numBands);
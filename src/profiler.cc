@@ -0,0 +1,98 @@
+#include <algorithm>
+
+#include "profiler.hh"
+
+namespace {
+
+const char* const zoneNames[Profiler::NUM_ZONES] = {
+  "frame",
+  "update",
+  "background",
+  "obstacles",
+  "overlay",
+  "upscale",
+  "flip",
+  "audio",
+};
+
+/// Writes micros as milliseconds with 2 decimals, 6 characters wide
+void writeMillis(perf::Window &window, uint32_t micros) {
+  window << perf::setw(6) << perf::fixed((micros + 5) / 10, 2);
+}
+
+}
+
+const char* Profiler::zoneName(ProfileZone zone) {
+  return zoneNames[static_cast<int>(zone)];
+}
+
+Profiler::Profiler(): enabled(false) {
+  for (ZoneHistory &zone: zones) {
+    zone.next = 0;
+    zone.count = 0;
+  }
+}
+
+void Profiler::setEnabled(bool enable) {
+  if (enable && !isEnabled()) {
+    collect();
+    for (ZoneHistory &zone: zones) {
+      zone.next = 0;
+      zone.count = 0;
+    }
+  }
+  enabled.store(enable, std::memory_order_relaxed);
+}
+
+void Profiler::collect() {
+  for (ZoneHistory &zone: zones) {
+    uint32_t micros;
+    while (zone.pending.pop(micros)) {
+      zone.ring[zone.next] = micros;
+      zone.next = (zone.next + 1) % RING_SIZE;
+      if (zone.count < RING_SIZE) ++zone.count;
+    }
+    // the lost timings only make the ring a bit older
+    zone.pending.takeOverflows();
+  }
+}
+
+Profiler::Stats Profiler::getStats(ProfileZone zone) const {
+  const ZoneHistory &history = zones[static_cast<int>(zone)];
+  Stats stats { history.count, 0, 0, 0, 0 };
+  if (!history.count) return stats;
+  uint32_t sorted[RING_SIZE];
+  uint64_t sum = 0;
+  stats.min = UINT32_MAX;
+  for (int i = 0; i < history.count; ++i) {
+    uint32_t micros = history.ring[i];
+    sorted[i] = micros;
+    sum += micros;
+    if (micros < stats.min) stats.min = micros;
+    if (micros > stats.max) stats.max = micros;
+  }
+  stats.avg = sum / history.count;
+  // the smallest timing at least 99% of the others are below
+  int p99 = (history.count * 99 + 99) / 100 - 1;
+  std::nth_element(sorted, sorted + p99, sorted + history.count);
+  stats.p99 = sorted[p99];
+  return stats;
+}
+
+void Profiler::render(perf::Window &window) {
+  collect();
+  window << "ms           min   avg   max   p99";
+  for (int i = 0; i < NUM_ZONES; ++i) {
+    window << perf::endl << zoneNames[i];
+    for (int pad = strlen(zoneNames[i]); pad < 10; ++pad) window << " ";
+    Stats stats = getStats(static_cast<ProfileZone>(i));
+    if (!stats.count) {
+      window << "     -     -     -     -";
+      continue;
+    }
+    writeMillis(window, stats.min);
+    writeMillis(window, stats.avg);
+    writeMillis(window, stats.max);
+    writeMillis(window, stats.p99);
+  }
+}
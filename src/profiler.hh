@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+#include "perftext.hh"
+#include "spsc.hh"
+#include "trace.hh"
+#include "util.hh"
+
+enum class ProfileZone {
+  frame,
+  update,
+  background,
+  obstacles,
+  overlay,
+  upscale,
+  flip,
+  audio,
+  count,
+};
+
+/// Keeps the last RING_SIZE timings of every zone of a frame.
+///
+/// A zone can be timed on any thread, as long as it is always
+/// the same one at a time (the audio callback, the present thread),
+/// the timings get to the game thread through a queue per zone.
+class Profiler {
+public:
+  static const int RING_SIZE = 128;
+  static const int NUM_ZONES = static_cast<int>(ProfileZone::count);
+
+  /// In microseconds
+  struct Stats {
+    int count;
+    uint32_t min, avg, max, p99;
+  };
+private:
+  struct ZoneHistory {
+    // the thread timing the zone -> game thread
+    SpscQueue<uint32_t, 64> pending;
+    uint32_t ring[RING_SIZE];
+    int next;
+    int count;
+  };
+
+  ZoneHistory zones[NUM_ZONES];
+  std::atomic<bool> enabled;
+public:
+  Profiler();
+
+  static const char* zoneName(ProfileZone zone);
+
+  inline bool isEnabled() const {
+    return enabled.load(std::memory_order_relaxed);
+  }
+
+  /// Game thread, starts over with empty rings when enabled
+  void setEnabled(bool enable);
+
+  inline void record(ProfileZone zone, uint32_t micros) {
+    zones[static_cast<int>(zone)].pending.push(micros);
+  }
+
+  /// Game thread, moves the timings recorded since the last call to the rings
+  void collect();
+
+  /// Game thread, min/avg/max/p99 of what is in the ring of zone
+  Stats getStats(ProfileZone zone) const;
+
+  /// Game thread, collects and writes a line per zone to window
+  void render(perf::Window &window);
+};
+
+/// Times the zone from construction to destruction,
+/// if the profiler was enabled at construction,
+/// and traces it when recording a trace
+class ProfileScope {
+  Profiler &profiler;
+  ProfileZone zone;
+  uint32_t start;
+  bool active;
+  bool tracing;
+public:
+  inline ProfileScope(Profiler &profiler, ProfileZone zone):
+      profiler(profiler), zone(zone), active(profiler.isEnabled()), tracing(trace::isEnabled()) {
+    if (tracing) trace::begin(Profiler::zoneName(zone));
+    if (active) start = micros();
+  }
+
+  inline ~ProfileScope() {
+    if (active) profiler.record(zone, microDiff(start, micros()));
+    if (tracing) trace::end(Profiler::zoneName(zone));
+  }
+};
@@ -0,0 +1,89 @@
+#include "rle.hh"
+#include "blit.hh"
+#include <string.h>
+
+namespace {
+
+const uint32_t ALPHA = 0xFF000000u;
+
+// SKIP, COPY or BLEND
+inline uint32_t runKind(uint32_t pixel) {
+  uint32_t a = pixel >> 24;
+  return !a ? 0 : a == 0xFF ? 1 : 2;
+}
+
+}
+
+bool RleSprite::encode(SDL_Surface *surface) {
+  data.clear();
+  rowStart.clear();
+  width = height = 0;
+  if (!(surface->flags & SDL_SRCALPHA) || surface->format->BitsPerPixel != 32 ||
+      surface->format->Amask != ALPHA) return false;
+  if (SDL_MUSTLOCK(surface) && SDL_LockSurface(surface) < 0) return false;
+  width = surface->w;
+  height = surface->h;
+  rowStart.reserve(height);
+  const uint32_t *line = static_cast<const uint32_t*>(surface->pixels);
+  int32_t pitch = surface->pitch >> 2;
+  for (int y = 0; y < height; ++y) {
+    rowStart.push_back(data.size());
+    int x = 0;
+    while (x < width) {
+      uint32_t kind = runKind(line[x]);
+      int end = x + 1;
+      while (end < width && runKind(line[end]) == kind) ++end;
+      data.push_back(kind << 30 | (end - x));
+      if (kind != SKIP) data.insert(data.end(), line + x, line + end);
+      x = end;
+    }
+    line += pitch;
+  }
+  if (SDL_MUSTLOCK(surface)) SDL_UnlockSurface(surface);
+  return true;
+}
+
+int RleSprite::blit(const SDL_Rect *srcRect, SDL_Surface *dst, SDL_Rect *dstRect) const {
+  SDL_Rect fullDst { 0, 0, 0, 0 };
+  if (!dstRect) dstRect = &fullDst;
+  SDL_Rect area;
+  if (empty() || !clipBlit(width, height, srcRect, dst, dstRect, area)) return 0;
+  if (SDL_MUSTLOCK(dst) && SDL_LockSurface(dst) < 0) return -1;
+  // opaque runs keep the alpha channel of dst, like blending does,
+  // unless there is none to keep
+  bool keepAlpha = dst->format->Amask != 0;
+  int32_t dstPitch = dst->pitch >> 2;
+  uint32_t *dp = static_cast<uint32_t*>(dst->pixels) + dstRect->y * dstPitch + dstRect->x;
+  int left = area.x;
+  int right = area.x + area.w;
+  for (int y = area.y; y < area.y + area.h; ++y) {
+    const uint32_t *run = data.data() + rowStart[y];
+    int x = 0;
+    while (x < right) {
+      uint32_t head = *run++;
+      uint32_t kind = head >> 30;
+      int end = x + (head & LENGTH_MASK);
+      if (kind != SKIP) {
+        int from = x > left ? x : left;
+        int to = end < right ? end : right;
+        if (from < to) {
+          uint32_t *d = dp + (from - left);
+          const uint32_t *s = run + (from - x);
+          int count = to - from;
+          if (kind == BLEND) {
+            blendRow(d, s, count, AlphaMode::straight);
+          } else if (!keepAlpha) {
+            memcpy(d, s, count * 4);
+          } else {
+            for (int i = 0; i < count; ++i) d[i] = (s[i] & ~ALPHA) | (d[i] & ALPHA);
+          }
+        }
+        run += end - x;
+      }
+      x = end;
+    }
+    dp += dstPitch;
+  }
+  if (SDL_MUSTLOCK(dst)) SDL_UnlockSurface(dst);
+  return 0;
+}
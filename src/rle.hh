@@ -0,0 +1,49 @@
+#pragma once
+
+#include <SDL/SDL.h>
+#include <stdint.h>
+#include <vector>
+
+/// A sprite with per pixel alpha stored row by row as runs of
+/// transparent, opaque and translucent pixels. Blitting skips the
+/// transparent runs, copies the opaque ones and only blends the rest,
+/// which is most of the work saved for sprites that are largely empty
+/// or solid.
+class RleSprite {
+  // each run is a word with the kind in the top two bits and the
+  // number of pixels in the rest, copy and blend runs are followed
+  // by their pixels
+  static const uint32_t SKIP = 0;
+  static const uint32_t COPY = 1;
+  static const uint32_t BLEND = 2;
+  static const uint32_t LENGTH_MASK = 0x3FFFFFFF;
+
+  std::vector<uint32_t> data;
+  std::vector<uint32_t> rowStart;
+  int width;
+  int height;
+public:
+  inline RleSprite(): width(0), height(0) { }
+
+  /// Encodes the pixels of a 32 bit surface with per pixel alpha
+  /// (SDL_SRCALPHA) in the top byte. Returns false, leaving the sprite
+  /// empty, for any other kind of surface.
+  bool encode(SDL_Surface *surface);
+
+  inline bool empty() const {
+    return rowStart.empty();
+  }
+
+  inline int getWidth() const {
+    return width;
+  }
+
+  inline int getHeight() const {
+    return height;
+  }
+
+  /// Draws the sprite like blendBlit with straight alpha would, with
+  /// the same clipping. Only valid for a dst that canBlend accepts
+  /// with the encoded surface.
+  int blit(const SDL_Rect *srcRect, SDL_Surface *dst, SDL_Rect *dstRect) const;
+};
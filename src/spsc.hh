@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+/// Bounded lock-free ring buffer for exactly one producer thread
+/// and one consumer thread (like the game thread feeding the audio
+/// callback). The capacity has to be a power of two.
+///
+/// The read and write positions are free running counters, the
+/// producer publishes an item with a release store of the write
+/// position, the consumer frees a slot with a release store of the
+/// read position, so the item contents are always visible to the
+/// other side before the position that covers them.
+template<typename T, uint32_t capacity> class SpscQueue {
+  static_assert(capacity && !(capacity & (capacity - 1)), "capacity must be a power of two");
+  static const uint32_t mask = capacity - 1;
+
+  T items[capacity];
+  // owned by the consumer
+  alignas(64) std::atomic<uint32_t> readPos;
+  // owned by the producer
+  alignas(64) std::atomic<uint32_t> writePos;
+  std::atomic<uint32_t> overflows;
+public:
+  inline SpscQueue(): readPos(0), writePos(0), overflows(0) { }
+
+  /// Producer side. Returns false if the queue is full,
+  /// in which case the item is dropped and counted as an overflow.
+  inline bool push(const T &item) {
+    uint32_t w = writePos.load(std::memory_order_relaxed);
+    if (w - readPos.load(std::memory_order_acquire) >= capacity) {
+      overflows.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    items[w & mask] = item;
+    writePos.store(w + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Consumer side. Returns the oldest item without removing it,
+  /// or nullptr if the queue is empty.
+  inline T* peek() {
+    uint32_t r = readPos.load(std::memory_order_relaxed);
+    if (r == writePos.load(std::memory_order_acquire)) return nullptr;
+    return items + (r & mask);
+  }
+
+  /// Consumer side. Removes the oldest item, only valid
+  /// after peek returned an item.
+  inline void drop() {
+    readPos.store(readPos.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  /// Consumer side. Moves the oldest item to result,
+  /// returns false if the queue is empty.
+  inline bool pop(T &result) {
+    T *item = peek();
+    if (!item) return false;
+    result = *item;
+    drop();
+    return true;
+  }
+
+  /// Number of items in the queue, only exact when called
+  /// from one of the two threads while the other one is idle
+  inline uint32_t size() const {
+    return writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_acquire);
+  }
+
+  /// Returns the number of items dropped by push since the last call
+  inline uint32_t takeOverflows() {
+    return overflows.exchange(0, std::memory_order_relaxed);
+  }
+};
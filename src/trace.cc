@@ -0,0 +1,188 @@
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.hh"
+#include "format.hh"
+
+namespace trace {
+
+std::atomic<bool> recording(false);
+
+namespace {
+
+const int MAX_THREADS = 16;
+// per thread, the game thread fills it in a bit over a minute at 60 fps,
+// then the oldest events are overwritten
+const uint32_t MAX_EVENTS = 1 << 16;
+// oldest events left out of a full ring, a thread that saw recording
+// still on may write a few more after finish() read the count
+const uint32_t UNSAFE_EVENTS = 64;
+
+struct Event {
+  uint64_t nanos;
+  const char *name;
+  char phase;
+};
+
+/// A ring only the owner thread writes, finish() reads
+/// the last MAX_EVENTS below the count it published
+struct ThreadBuffer {
+  Event events[MAX_EVENTS];
+  // all the events ever recorded, not wrapped
+  std::atomic<uint32_t> count;
+  std::atomic<const char*> name;
+
+  inline ThreadBuffer(): count(0), name(nullptr) { }
+};
+
+std::atomic<ThreadBuffer*> threads[MAX_THREADS];
+std::atomic<int> numThreads(0);
+thread_local ThreadBuffer *threadBuffer = nullptr;
+// set on threads past MAX_THREADS, they record nothing
+thread_local bool threadIgnored = false;
+char tracePath[256];
+uint64_t startNanos;
+
+inline uint64_t nanos() {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+/// Returns the id of the new buffer or -1 if all are taken
+int addThreadBuffer(const char *name) {
+  int id = numThreads.fetch_add(1);
+  if (id >= MAX_THREADS) return -1;
+  ThreadBuffer *buffer = new ThreadBuffer();
+  buffer->name.store(name, std::memory_order_relaxed);
+  threads[id].store(buffer, std::memory_order_release);
+  return id;
+}
+
+ThreadBuffer* getThreadBuffer() {
+  if (threadBuffer || threadIgnored) return threadBuffer;
+  int id = addThreadBuffer(nullptr);
+  if (id < 0) {
+    threadIgnored = true;
+    return nullptr;
+  }
+  threadBuffer = threads[id].load(std::memory_order_relaxed);
+  return threadBuffer;
+}
+
+void record(const char *name, char phase) {
+  // the scopes still open when finish() was called end here
+  if (!isEnabled()) return;
+  ThreadBuffer *buffer = getThreadBuffer();
+  if (!buffer) return;
+  uint32_t n = buffer->count.load(std::memory_order_relaxed);
+  Event &event = buffer->events[n % MAX_EVENTS];
+  event.nanos = nanos();
+  event.name = name;
+  event.phase = phase;
+  buffer->count.store(n + 1, std::memory_order_release);
+}
+
+}
+
+void start(const char *path) {
+  strncpy(tracePath, path, sizeof(tracePath) - 1);
+  startNanos = nanos();
+  recording.store(true, std::memory_order_relaxed);
+  std::cerr << "Tracing to " << tracePath << std::endl;
+}
+
+void begin(const char *name) {
+  record(name, 'B');
+}
+
+void end(const char *name) {
+  record(name, 'E');
+}
+
+void setThreadName(const char *name) {
+  if (!isEnabled()) return;
+  ThreadBuffer *buffer = getThreadBuffer();
+  if (buffer) buffer->name.store(name, std::memory_order_relaxed);
+}
+
+int reserveThread(const char *name) {
+  if (!isEnabled()) return -1;
+  return addThreadBuffer(name);
+}
+
+void attachThread(int id) {
+  if (threadBuffer || id < 0) return;
+  threadBuffer = threads[id].load(std::memory_order_acquire);
+}
+
+void finish() {
+  if (!recording.exchange(false)) return;
+  FILE *f = fopen(tracePath, "w");
+  if (!f) {
+    std::cerr << "Failed to open " << tracePath << " for writing the trace" << std::endl;
+    return;
+  }
+  fputs("{\"traceEvents\":[\n", f);
+  uint32_t numEvents = 0;
+  uint32_t numOverwritten = 0;
+  const char *separator = "";
+  char line[256];
+  int count = numThreads.load(std::memory_order_acquire);
+  for (int tid = 0; tid < count && tid < MAX_THREADS; ++tid) {
+    ThreadBuffer *buffer = threads[tid].load(std::memory_order_acquire);
+    if (!buffer) continue;
+    const char *name = buffer->name.load(std::memory_order_relaxed);
+    if (name) {
+      char *p = formatString(line, separator);
+      p = formatString(p, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":");
+      p = formatSigned(p, tid);
+      p = formatString(p, ",\"args\":{\"name\":\"");
+      p = formatString(p, name);
+      formatString(p, "\"}}");
+      fputs(line, f);
+      separator = ",\n";
+    }
+    uint32_t n = buffer->count.load(std::memory_order_acquire);
+    uint32_t first = 0;
+    if (n > MAX_EVENTS) {
+      first = n - MAX_EVENTS + UNSAFE_EVENTS;
+      numOverwritten += first;
+    }
+    // the ends of the scopes begun before the first event kept
+    int depth = 0;
+    for (uint32_t i = first; i < n; ++i) {
+      const Event &event = buffer->events[i % MAX_EVENTS];
+      if (event.phase == 'B') {
+        ++depth;
+      } else if (depth) {
+        --depth;
+      } else {
+        continue;
+      }
+      char *p = formatString(line, separator);
+      p = formatString(p, "{\"name\":\"");
+      p = formatString(p, event.name);
+      p = formatString(p, "\",\"ph\":\"");
+      *p++ = event.phase;
+      p = formatString(p, "\",\"pid\":1,\"tid\":");
+      p = formatSigned(p, tid);
+      p = formatString(p, ",\"ts\":");
+      // in microseconds
+      p = formatFixed(p, event.nanos - startNanos, 3);
+      formatString(p, "}");
+      fputs(line, f);
+      separator = ",\n";
+      ++numEvents;
+    }
+  }
+  fputs("\n],\"displayTimeUnit\":\"ms\"}\n", f);
+  fclose(f);
+  std::cerr << "Wrote " << numEvents << " trace events to " << tracePath;
+  if (numOverwritten) std::cerr << ", the oldest " << numOverwritten << " were overwritten";
+  std::cerr << std::endl;
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+/// Timeline tracing: begin/end events recorded into a ring buffer per
+/// thread without locks, written out as Chrome trace JSON (open it
+/// in chrome://tracing or ui.perfetto.dev) by finish(). A thread keeps
+/// its last 65536 events, a bit over a minute of the game thread.
+///
+/// Event names are not copied, they have to outlive the trace
+/// (string literals).
+namespace trace {
+
+  extern std::atomic<bool> recording;
+
+  /// Starts recording, finish() writes the events to path
+  void start(const char *path);
+
+  /// Stops recording and writes the events recorded so far.
+  /// Threads still running can keep calling begin and end.
+  void finish();
+
+  inline bool isEnabled() {
+    return recording.load(std::memory_order_relaxed);
+  }
+
+  void begin(const char *name);
+  void end(const char *name);
+
+  /// Names the calling thread in the trace
+  void setThreadName(const char *name);
+
+  /// Allocates a named buffer for a thread that can't allocate on its
+  /// first event (the SDL audio callback), returns -1 when not recording
+  int reserveThread(const char *name);
+
+  /// The calling thread records to the reserved buffer id from now on,
+  /// unless it already has one
+  void attachThread(int id);
+
+  /// An event from construction to destruction,
+  /// if recording when it was constructed
+  class Scope {
+    const char *name;
+    bool active;
+  public:
+    inline Scope(const char *name): name(name), active(isEnabled()) {
+      if (active) begin(name);
+    }
+
+    inline ~Scope() {
+      if (active) end(name);
+    }
+  };
+
+}
@@ -9,7 +9,7 @@ uint32_t micros() {
 }
 
 uint32_t microDiff(uint32_t start, uint32_t end) {
-  return end < start ? 1000000000 - end + start : end - start;
+  return end < start ? 1000000000 - start + end : end - start;
 }
 
 uint64_t nextSeed(uint64_t seed) {
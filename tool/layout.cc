@@ -6,10 +6,16 @@
 #include <string>
 #include <filesystem>
 #include <vector>
+#include <algorithm>
 namespace fs = std::filesystem;
 
 #include "../src/input.hh"
 #include "../src/pack.hh"
+#include "../src/image.hh"
+#include "../src/lz4.hh"
+#include "../src/atlas.hh"
+#include "../src/stb_image.h"
+#include "../src/fda.h"
 
 using namespace std;
 
@@ -250,8 +256,235 @@ struct AssetFile {
   string name;
   string path;
   uint32_t size;
+  // packed instead of the file when not empty
+  vector<uint8_t> contents;
 };
 
+enum class PixelMode {
+  png,
+  raw,
+  lz4,
+};
+
+/// Decodes a PNG into pixels in the usual 32 bit display format (ARGB)
+bool decodePNG(const uint8_t *png, uint32_t size, int &width, int &height, vector<uint32_t> &pixels) {
+  int channels;
+  unsigned char *rgba = stbi_load_from_memory(png, size, &width, &height, &channels, STBI_rgb_alpha);
+  if (!rgba) {
+    cerr << "Unable to decode PNG: " << stbi_failure_reason() << endl;
+    return false;
+  }
+  pixels.resize(width * height);
+  for (int i = 0; i < width * height; ++i) {
+    const unsigned char *p = rgba + i * 4;
+    pixels[i] = p[3] << 24 | p[0] << 16 | p[1] << 8 | p[2];
+  }
+  stbi_image_free(rgba);
+  return true;
+}
+
+/// Decodes a sprite slice, a PNG or a PixelPayload stored earlier, into ARGB pixels
+bool decodeSprite(const uint8_t *bytes, uint32_t size, int &width, int &height, vector<uint32_t> &pixels) {
+  const PixelPayload *payload = reinterpret_cast<const PixelPayload*>(bytes);
+  if (size < sizeof(PixelPayload) || payload->magic != PixelPayload::MAGIC) {
+    return decodePNG(bytes, size, width, height, pixels);
+  }
+  if (payload->Rmask != 0x00ff0000 || payload->Gmask != 0x0000ff00 ||
+      payload->Bmask != 0x000000ff || payload->Amask != 0xff000000) {
+    cerr << "Unexpected pixel format in a pixel payload" << endl;
+    return false;
+  }
+  width = payload->width;
+  height = payload->height;
+  uint32_t pixelBytes = width * height * 4;
+  pixels.resize(width * height);
+  const uint8_t *data = reinterpret_cast<const uint8_t*>(payload->data);
+  if (sizeof(PixelPayload) + payload->dataSize > size) {
+    cerr << "Truncated pixel payload" << endl;
+    return false;
+  }
+  if (payload->flags & PixelPayload::FLAG_LZ4) {
+    if (lz4Decompress(data, payload->dataSize, reinterpret_cast<uint8_t*>(pixels.data()), pixelBytes) != pixelBytes) {
+      cerr << "Unable to decompress pixel payload" << endl;
+      return false;
+    }
+  } else {
+    if (payload->dataSize < pixelBytes) {
+      cerr << "Truncated pixel payload" << endl;
+      return false;
+    }
+    memcpy(pixels.data(), data, pixelBytes);
+  }
+  return true;
+}
+
+/// Stores ARGB pixels as a PixelPayload, compressed in lz4 mode
+void encodePixels(const vector<uint32_t> &pixels, int width, int height, PixelMode mode, vector<uint8_t> &payload) {
+  uint32_t pixelBytes = pixels.size() * 4;
+  payload.resize(sizeof(PixelPayload) + (mode == PixelMode::lz4 ? lz4Bound(pixelBytes) : pixelBytes));
+  PixelPayload *header = reinterpret_cast<PixelPayload*>(payload.data());
+  header->magic = PixelPayload::MAGIC;
+  header->width = width;
+  header->height = height;
+  header->Rmask = 0x00ff0000;
+  header->Gmask = 0x0000ff00;
+  header->Bmask = 0x000000ff;
+  header->Amask = 0xff000000;
+  if (mode == PixelMode::lz4) {
+    header->flags = PixelPayload::FLAG_LZ4;
+    header->dataSize = lz4Compress(reinterpret_cast<const uint8_t*>(pixels.data()), pixelBytes,
+        reinterpret_cast<uint8_t*>(header->data));
+  } else {
+    header->flags = 0;
+    header->dataSize = pixelBytes;
+    memcpy(header->data, pixels.data(), pixelBytes);
+  }
+  payload.resize(sizeof(PixelPayload) + header->dataSize);
+}
+
+/// Decodes a PNG into a PixelPayload, so the game can skip the PNG decode
+bool encodePixels(const uint8_t *png, uint32_t size, PixelMode mode, vector<uint8_t> &payload) {
+  int width, height;
+  vector<uint32_t> pixels;
+  if (!decodePNG(png, size, width, height, pixels)) return false;
+  encodePixels(pixels, width, height, mode, payload);
+  return true;
+}
+
+bool encodePixels(AssetFile &file, PixelMode mode) {
+  ifstream stream(file.path, ifstream::binary);
+  vector<uint8_t> png(file.size);
+  stream.read(reinterpret_cast<char*>(png.data()), file.size);
+  vector<uint8_t> payload;
+  if (!encodePixels(png.data(), png.size(), mode, payload)) return false;
+  cout << file.name << ": " << file.size << " bytes as PNG, " << payload.size() << " bytes as pixels" << endl;
+  file.contents = move(payload);
+  file.size = file.contents.size();
+  return true;
+}
+
+struct AtlasSprite {
+  const AssetFile *file;
+  int width;
+  int height;
+  vector<uint32_t> pixels;
+  int x;
+  int y;
+};
+
+/// Places the sprites on shelves, tallest first, on a page of the given
+/// width and returns the height of the page
+int placeOnShelves(vector<AtlasSprite*> &sprites, int pageWidth) {
+  int x = 0, y = 0, shelfHeight = 0;
+  for (AtlasSprite *sprite: sprites) {
+    if (x + sprite->width > pageWidth) {
+      x = 0;
+      y += shelfHeight;
+      shelfHeight = 0;
+    }
+    sprite->x = x;
+    sprite->y = y;
+    x += sprite->width;
+    if (sprite->height > shelfHeight) shelfHeight = sprite->height;
+  }
+  return y + shelfHeight;
+}
+
+/// Replaces the PNG files with a single atlas page holding all of them
+/// and the rect table telling where each one went. The sprites are read
+/// from contents when it is set (also as pixel payloads), from the file otherwise
+bool buildAtlas(vector<AssetFile> &files, PixelMode mode) {
+  vector<AtlasSprite> sprites;
+  vector<AssetFile> rest;
+  for (const AssetFile &file: files) {
+    if (fs::path(file.name).extension() != ".png") continue;
+    if (file.name.size() >= sizeof(AtlasRect::name)) {
+      cerr << file.name << ": name too long for the atlas" << endl;
+      return false;
+    }
+    vector<uint8_t> bytes(file.contents);
+    if (bytes.empty()) {
+      ifstream stream(file.path, ifstream::binary);
+      bytes.resize(file.size);
+      stream.read(reinterpret_cast<char*>(bytes.data()), file.size);
+    }
+    AtlasSprite sprite { };
+    sprite.file = &file;
+    if (!decodeSprite(bytes.data(), bytes.size(), sprite.width, sprite.height, sprite.pixels)) {
+      cerr << file.name << ": unable to decode" << endl;
+      return false;
+    }
+    sprites.push_back(move(sprite));
+  }
+  if (sprites.empty()) return true;
+
+  vector<AtlasSprite*> order;
+  int widest = 0;
+  for (AtlasSprite &sprite: sprites) {
+    order.push_back(&sprite);
+    if (sprite.width > widest) widest = sprite.width;
+  }
+  sort(order.begin(), order.end(), [](const AtlasSprite *a, const AtlasSprite *b) {
+    return a->height > b->height;
+  });
+  // the narrowest page width, in steps of 16, that wastes the least,
+  // trying up to 2048 unless a sprite is wider than that
+  int minWidth = (widest + 15) & ~15;
+  int maxWidth = minWidth > 2048 ? minWidth : 2048;
+  int bestWidth = minWidth;
+  int64_t bestArea = INT64_MAX;
+  for (int width = minWidth; width <= maxWidth; width += 16) {
+    int64_t area = static_cast<int64_t>(width) * placeOnShelves(order, width);
+    if (area < bestArea) {
+      bestArea = area;
+      bestWidth = width;
+    }
+  }
+  int pageHeight = placeOnShelves(order, bestWidth);
+  int64_t pageArea = static_cast<int64_t>(bestWidth) * pageHeight;
+
+  vector<uint32_t> page(bestWidth * pageHeight, 0);
+  vector<uint8_t> table(sizeof(AtlasTable) + sprites.size() * sizeof(AtlasRect), 0);
+  AtlasTable *header = reinterpret_cast<AtlasTable*>(table.data());
+  header->magic = AtlasTable::MAGIC;
+  header->numRects = sprites.size();
+  for (uint32_t i = 0; i < sprites.size(); ++i) {
+    const AtlasSprite &sprite = sprites[i];
+    for (int y = 0; y < sprite.height; ++y) {
+      memcpy(page.data() + (sprite.y + y) * bestWidth + sprite.x,
+          sprite.pixels.data() + y * sprite.width, sprite.width * 4);
+    }
+    AtlasRect &r = header->rects[i];
+    strncpy(r.name, sprite.file->name.c_str(), sizeof(r.name) - 1);
+    r.x = sprite.x;
+    r.y = sprite.y;
+    r.w = sprite.width;
+    r.h = sprite.height;
+    cout << "Atlas: " << sprite.file->name << " at " << r.x << "," << r.y << " " << r.w << "x" << r.h << endl;
+  }
+  int64_t used = 0;
+  for (const AtlasSprite &sprite: sprites) used += sprite.width * sprite.height;
+  cout << "Atlas page: " << bestWidth << "x" << pageHeight << ", "
+      << (100 * used / pageArea) << "% used" << endl;
+
+  for (const AssetFile &file: files) {
+    if (fs::path(file.name).extension() != ".png") rest.push_back(file);
+  }
+  // the page has to be pixels, there is no PNG encoder here
+  AssetFile pageFile { };
+  pageFile.name = AtlasTable::PAGE_NAME;
+  encodePixels(page, bestWidth, pageHeight, mode == PixelMode::png ? PixelMode::lz4 : mode, pageFile.contents);
+  pageFile.size = pageFile.contents.size();
+  AssetFile tableFile { };
+  tableFile.name = AtlasTable::TABLE_NAME;
+  tableFile.size = table.size();
+  tableFile.contents = move(table);
+  rest.push_back(move(pageFile));
+  rest.push_back(move(tableFile));
+  files = move(rest);
+  return true;
+}
+
 struct SlicedBufferEditor: public SlicedBuffer {
   inline SlicedBufferEditor() {
     setMagic();
@@ -274,9 +507,9 @@ struct SlicedBufferEditor: public SlicedBuffer {
   }
 };
 
-KeyHasher packFiles(vector<AssetFile> names) {
+KeyHasher packFiles(vector<AssetFile> names, bool lanes) {
   uint32_t overallSize = 0;
-  for (AssetFile file: names) overallSize += (file.size + 3) & ~3;
+  for (const AssetFile &file: names) overallSize += (file.size + 3) & ~3;
   const int numKeys = names.size();
   bool taken[numKeys*2*16];
   int maxSize = numKeys;
@@ -386,8 +619,12 @@ KeyHasher packFiles(vector<AssetFile> names) {
         cerr << "Assertion failed, end pointer is over end: " << contentEnd << " > " << end << endl;
         exit(1);
       }
-      ifstream stream(names[j].path, ifstream::binary);
-      stream.read(reinterpret_cast<char*>(contentPos), names[j].size);
+      if (names[j].contents.size()) {
+        memcpy(contentPos, names[j].contents.data(), names[j].size);
+      } else {
+        ifstream stream(names[j].path, ifstream::binary);
+        stream.read(reinterpret_cast<char*>(contentPos), names[j].size);
+      }
       slices[j].set(contentPos, names[j].size);
       if (slices[j].ptr() != contentPos) {
         cerr << "Assertion failed, pointer did not resolve correctly: got " << slices[j].ptr() << " instead of " << contentPos << endl;
@@ -407,18 +644,13 @@ KeyHasher packFiles(vector<AssetFile> names) {
     cout << endl;
     for (int i = 0; i < tableSize; ++i) {
       if (~table[i*2]) {
-        uint32_t h = table[i*2];
         BufferSlice *slice = slices + table[i*2+1];
         uint32_t *p = reinterpret_cast<uint32_t*>(slice->ptr());
-        uint32_t size = (slice->sizeInBytes + 3) >> 2;
-        for (int j = 0; j < size; ++j) {
-          uint32_t op = p[j];
-          p[j] ^= h;
-          h += hasher.hash(op);
-        }
+        obfuscateWords(p, (slice->sizeInBytes + 3) >> 2, table[i*2], hasher, lanes);
       }
     }
-    sbe->flags |= 1;
+    sbe->flags |= SlicedBuffer::FLAG_OBFUSCATED;
+    if (lanes) sbe->flags |= SlicedBuffer::FLAG_LANES;
     ofstream output(baseDir+"/../.."+assets+"assets.bin", ofstream::binary);
     if (output.is_open()) {
       output.write(reinterpret_cast<char*>(start), bufferWordSize << 2);
@@ -428,7 +660,7 @@ KeyHasher packFiles(vector<AssetFile> names) {
   return bestHasher;
 }
 
-void packFiles(bool force) {
+void packFiles(bool force, bool lanes, PixelMode pixelMode, bool atlas) {
   cout << "Packing files..." << endl;
   vector<AssetFile> files;
   for (const fs::directory_entry &entry: fs::directory_iterator(baseDir+"/../.."+assets)) {
@@ -449,11 +681,171 @@ void packFiles(bool force) {
     ++offset;
     ifstream file(path.string(), ifstream::ate | ifstream::binary);
     uint32_t fileSize = file.tellg();
-    AssetFile assetFile { .name = ps.substr(offset), .path = path.string(), .size = fileSize };
+    AssetFile assetFile { .name = ps.substr(offset), .path = path.string(), .size = fileSize, .contents = { } };
+    if (ext == ".png" && pixelMode != PixelMode::png && !atlas && !encodePixels(assetFile, pixelMode)) return;
     files.push_back(assetFile);
   }
-  KeyHasher hasher = packFiles(files);
+  if (atlas && !buildAtlas(files, pixelMode)) return;
+  KeyHasher hasher = packFiles(files, lanes);
+
+}
+
+/// Rebuilds assets.bin from its own slices with the sprites moved onto an
+/// atlas page. The pack only has the hashes of the names, so the names
+/// come from the files in the assets directory (their contents are not
+/// used), and every slice has to match one of them.
+bool repackAtlas(SlicedBuffer *pack, const string &dir, bool lanes, PixelMode pixelMode) {
+  vector<AssetFile> files;
+  for (const fs::directory_entry &entry: fs::directory_iterator(dir)) {
+    if (!entry.is_regular_file()) continue;
+    fs::path path = entry.path();
+    string ext = path.extension().string();
+    if (ext == ".layout" || ext == ".bin" || path.filename().string() == "doNotPack.txt") continue;
+    AssetFile file { };
+    file.name = assets.substr(1) + path.filename().string();
+    BufferView view = pack->lookup(file.name.c_str());
+    if (!view.buffer) {
+      cout << file.name << ": not in the pack, skipped" << endl;
+      continue;
+    }
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(view.buffer);
+    file.contents.assign(bytes, bytes + view.sizeInBytes);
+    file.size = view.sizeInBytes;
+    files.push_back(move(file));
+  }
+  if (files.size() != pack->numSlices) {
+    cerr << "Only " << files.size() << " of the " << pack->numSlices << " slices have a name in "
+        << dir << ", bailing out" << endl;
+    return false;
+  }
+  if (!buildAtlas(files, pixelMode)) return false;
+  packFiles(files, lanes);
+  return true;
+}
 
+/// Rewrites assets.bin with its PNG slices stored as pixel payloads,
+/// keeping the hasher and the table, so it works without the source files.
+/// With atlas the sprites go on an atlas page, see repackAtlas.
+bool repackPixels(bool force, bool lanes, PixelMode pixelMode, bool atlas) {
+  string dir = baseDir+"/../.."+assets;
+  if (!force && fs::exists(dir+"doNotPack.txt")) {
+    cerr << "Found doNotPack.txt, bailing out" << endl;
+    return false;
+  }
+  cout << "Repacking " << dir << "assets.bin..." << endl;
+  ifstream input(dir+"assets.bin", ifstream::ate | ifstream::binary);
+  if (!input.is_open()) {
+    cerr << "Unable to open assets.bin" << endl;
+    return false;
+  }
+  uint32_t size = input.tellg();
+  input.seekg(0);
+  vector<uint32_t> packWords((size + 3) >> 2);
+  input.read(reinterpret_cast<char*>(packWords.data()), size);
+  input.close();
+  SlicedBufferEditor *pack = reinterpret_cast<SlicedBufferEditor*>(packWords.data());
+  if (pack->magic != SlicedBuffer::MAGIC) {
+    cerr << "Not an asset pack" << endl;
+    return false;
+  }
+  if (atlas) return repackAtlas(pack, dir, lanes, pixelMode);
+  uint32_t *table = pack->getTable();
+  BufferSlice *slices = pack->getSlices();
+  vector<vector<uint8_t>> contents(pack->numSlices);
+  vector<uint32_t> hashes(pack->numSlices, 0);
+  for (uint32_t i = 0; i < pack->numTableEntries; ++i) {
+    if (!~table[i*2]) continue;
+    uint32_t sliceIndex = table[i*2+1] & ~SlicedBuffer::SLICE_DECODED;
+    BufferSlice *slice = slices + sliceIndex;
+    uint32_t *p = reinterpret_cast<uint32_t*>(slice->ptr());
+    if (pack->flags & SlicedBuffer::FLAG_OBFUSCATED) {
+      deobfuscateWords(p, (slice->sizeInBytes + 3) >> 2, table[i*2], pack->hasher, pack->flags & SlicedBuffer::FLAG_LANES);
+    }
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(p);
+    static const uint8_t pngSignature[] = { 0x89, 'P', 'N', 'G' };
+    if (slice->sizeInBytes > 4 && memcmp(bytes, pngSignature, 4) == 0) {
+      if (!encodePixels(bytes, slice->sizeInBytes, pixelMode, contents[sliceIndex])) return false;
+      cout << "Slice " << sliceIndex << ": " << slice->sizeInBytes << " bytes as PNG, " << contents[sliceIndex].size() << " bytes as pixels" << endl;
+    } else {
+      contents[sliceIndex].assign(bytes, bytes + slice->sizeInBytes);
+    }
+    hashes[sliceIndex] = table[i*2];
+  }
+
+  uint32_t headerWords = (sizeof(SlicedBuffer) + pack->numTableEntries * 2 * 4 + sizeof(BufferSlice) * pack->numSlices) >> 2;
+  uint32_t outputWords = headerWords;
+  for (const vector<uint8_t> &c: contents) outputWords += (c.size() + 3) >> 2;
+  vector<uint32_t> output(outputWords, 0);
+  memcpy(output.data(), packWords.data(), headerWords << 2);
+  SlicedBufferEditor *repacked = reinterpret_cast<SlicedBufferEditor*>(output.data());
+  uint32_t *outputTable = repacked->getTable();
+  for (uint32_t i = 0; i < repacked->numTableEntries; ++i) {
+    if (~outputTable[i*2]) outputTable[i*2+1] &= ~SlicedBuffer::SLICE_DECODED;
+  }
+  BufferSlice *outputSlices = repacked->getSlices();
+  uint32_t *contentPos = repacked->getContents();
+  for (uint32_t j = 0; j < repacked->numSlices; ++j) {
+    memcpy(contentPos, contents[j].data(), contents[j].size());
+    outputSlices[j].set(contentPos, contents[j].size());
+    if (pack->flags & SlicedBuffer::FLAG_OBFUSCATED) {
+      obfuscateWords(contentPos, (contents[j].size() + 3) >> 2, hashes[j], repacked->hasher, lanes);
+    }
+    contentPos += (contents[j].size() + 3) >> 2;
+  }
+  repacked->flags &= ~SlicedBuffer::FLAG_LANES;
+  if (lanes && (repacked->flags & SlicedBuffer::FLAG_OBFUSCATED)) repacked->flags |= SlicedBuffer::FLAG_LANES;
+  ofstream stream(dir+"assets.bin", ofstream::binary);
+  if (!stream.is_open()) return false;
+  stream.write(reinterpret_cast<char*>(output.data()), outputWords << 2);
+  cout << size << " bytes before, " << (outputWords << 2) << " bytes after" << endl;
+  return true;
+}
+
+/// Decodes every frame with both the reference and the fast FDA decoder,
+/// and checks that they produce exactly the same samples
+bool checkFda(const string &path) {
+  cout << "Checking " << path << "..." << endl;
+  ifstream file(path, ifstream::ate | ifstream::binary);
+  if (!file.is_open()) {
+    cerr << "Unable to open file: " << path << endl;
+    return false;
+  }
+  uint32_t size = file.tellg();
+  file.seekg(0);
+  vector<uint8_t> bytes(size);
+  file.read(reinterpret_cast<char*>(bytes.data()), size);
+  file.close();
+
+  fda_desc reference, fast;
+  uint32_t p = fda_decode_header(bytes.data(), size, &reference);
+  if (!p || fda_decode_header(bytes.data(), size, &fast) != p) {
+    cerr << "Not an FDA file: " << path << endl;
+    return false;
+  }
+  vector<short> expected(FDA_FRAME_LEN * reference.channels);
+  vector<short> actual(FDA_FRAME_LEN * reference.channels);
+  float referenceSeconds = 0, fastSeconds = 0;
+  uint32_t numFrames = 0;
+  while (p < size) {
+    unsigned referenceLength, fastLength;
+    Timestamp start;
+    uint32_t referenceSize = fda_decode_frame(bytes.data() + p, size - p, &reference, expected.data(), &referenceLength);
+    referenceSeconds += start.elapsedSeconds(true);
+    uint32_t fastSize = fda_decode_frame_fast(bytes.data() + p, size - p, &fast, actual.data(), &fastLength);
+    fastSeconds += start.elapsedSeconds();
+    if (!referenceSize) break;
+    if (fastSize != referenceSize || fastLength != referenceLength ||
+        memcmp(expected.data(), actual.data(), referenceLength * reference.channels * sizeof(short))) {
+      cerr << "Mismatch in frame " << numFrames << " at offset " << p << endl;
+      return false;
+    }
+    p += referenceSize;
+    ++numFrames;
+  }
+  cout << "Frames: " << numFrames << ", all match" << endl;
+  cout << "Reference: " << referenceSeconds * 1000.0f << " ms" << endl;
+  cout << "Fast: " << fastSeconds * 1000.0f << " ms" << endl;
+  return true;
 }
 
 int main(int argc, const char **argv) {
@@ -461,11 +853,23 @@ int main(int argc, const char **argv) {
   baseDir = fsPath.parent_path().string();
   string lastArg = argc > 1 ? string(argv[argc-1]) : "";
   bool force = false;
+  // obfuscate in 4 interleaved lanes so the game can decode with SIMD
+  bool lanes = false;
+  // store sprites decoded, optionally LZ4 compressed
+  PixelMode pixelMode = PixelMode::png;
+  // put every sprite on one atlas page
+  bool atlas = false;
   for (int i = 1; i < argc; ++i) {
     if (strncmp(argv[i], "-f", 3) == 0) force = true;
+    if (strncmp(argv[i], "-lanes", 7) == 0) lanes = true;
+    if (strncmp(argv[i], "-pixels", 8) == 0) pixelMode = PixelMode::raw;
+    if (strncmp(argv[i], "-lz4", 5) == 0) pixelMode = PixelMode::lz4;
+    if (strncmp(argv[i], "-atlas", 7) == 0) atlas = true;
   }
   if (!lastArg.length() || lastArg == "layouts") layoutAll();
-  if (!lastArg.length() || lastArg == "pack") packFiles(force);
+  if (!lastArg.length() || lastArg == "pack") packFiles(force, lanes, pixelMode, atlas);
+  if (lastArg == "repack" && !repackPixels(force, lanes, pixelMode, atlas)) return 1;
+  if (lastArg == "fdacheck" && !checkFda(baseDir + "/../.." + assets + "80sloop.fda")) return 1;
   return 0;
 }
 